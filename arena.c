@@ -0,0 +1,219 @@
+/**
+ * @file      arena.c
+ * @brief     Arena allocator for toy kernel.
+ *
+ * An arena hands out memory by bumping a pointer through chunks that it
+ * obtains from the general purpose allocator. Memory is never freed
+ * object by object; all of it is given back at once, by resetting the
+ * arena (for reuse) or by destroying it. This suits memory of a single
+ * request, whose objects all live and die together.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <arena.h>
+#include <mem.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Header of a chunk. Kept at start of the chunk, memory follows it. */
+typedef struct chunk_ {
+	struct chunk_	*next;	/* Next chunk of the arena */
+	char	*end;		/* End of chunk */
+} __attribute__ ((aligned (MEM_ALIGN))) chunk_t;
+
+/* Arena. Kept in its first chunk, after the chunk header. */
+struct arena_ {
+	chunk_t	*first;		/* First chunk */
+	chunk_t	*cur;		/* Chunk being allocated from */
+	char	*ptr;		/* Next free byte in "cur" */
+	int	chunkSize;	/* Size of chunks */
+} __attribute__ ((aligned (MEM_ALIGN)));
+
+/**
+ * @brief
+ * Get a chunk from memory management and link it into an arena after
+ * its current chunk.
+ *
+ * @param[in]
+ *       arena: Arena.
+ *       size: Number of bytes needed in chunk.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to new chunk
+ *       - Failure : NULL
+ */
+static chunk_t *
+chunkAdd(arena_t *arena, int size)
+{
+	chunk_t	*c;
+
+	if (size > INT_MAX - (int) sizeof(chunk_t)) {
+		return NULL;
+	}
+	size += sizeof(chunk_t);
+	if (size < arena->chunkSize) {
+		size = arena->chunkSize;
+	}
+	c = memAlloc(size);
+	if (c == NULL) {
+		return NULL;
+	}
+	c->end = (char *) c + size;
+	c->next = arena->cur->next;
+	arena->cur->next = c;
+	return c;
+}
+
+/**
+ * @brief
+ * API to create an arena.
+ *
+ * @param[in]
+ *       chunkSize: Size of the chunks the arena grows by.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to new arena
+ *       - Failure : NULL
+ */
+arena_t *
+arenaCreate(int chunkSize)
+{
+	chunk_t	*c;
+	arena_t	*arena;
+
+	/* First chunk must have room beyond the headers. */
+	if (chunkSize < 2 * (int) (sizeof(chunk_t) + sizeof(arena_t))) {
+		chunkSize = 2 * (sizeof(chunk_t) + sizeof(arena_t));
+	}
+	c = memAlloc(chunkSize);
+	if (c == NULL) {
+		return NULL;
+	}
+	c->next = NULL;
+	c->end = (char *) c + chunkSize;
+	arena = (arena_t *) (c + 1);
+	arena->first = arena->cur = c;
+	arena->ptr = (char *) (arena + 1);
+	arena->chunkSize = chunkSize;
+	return arena;
+}
+
+/**
+ * @brief
+ * API to destroy an arena. All memory allocated from the arena is
+ * returned to memory management.
+ *
+ * @param[in]
+ *       arena: Arena to be destroyed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+arenaDestroy(arena_t *arena)
+{
+	chunk_t	*c, *next;
+
+	if (!arena) return;
+
+	/* The arena itself is in the first chunk, which goes last. */
+	for (c = arena->first->next; c; c = next) {
+		next = c->next;
+		memFree(c);
+	}
+	memFree(arena->first);
+	return;
+}
+
+/**
+ * @brief
+ * API to allocate memory from an arena.
+ *
+ * @note
+ * This is a pointer bump in the current chunk. When the request does
+ * not fit, the arena moves on to its next chunk, if that is large
+ * enough, or else puts a new chunk in its place (of the arena's chunk
+ * size, or larger for a large request).
+ *
+ * @param[in]
+ *       arena: Arena to allocate from.
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to MEM_ALIGN aligned memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+void *
+arenaAlloc(arena_t *arena, int size)
+{
+	chunk_t	*c;
+	char	*p;
+
+	if ((size < 0) || (size > INT_MAX - MEM_ALIGN)) {
+		return NULL;
+	}
+	size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+	if (size > arena->cur->end - arena->ptr) {
+		c = arena->cur->next;
+		if (c && (size > c->end - (char *) (c + 1))) {
+			/* Replace it, so that chunks that are too small
+			 * do not pile up over resets.
+			 */
+			arena->cur->next = c->next;
+			memFree(c);
+			c = NULL;
+		}
+		if (!c) {
+			c = chunkAdd(arena, size);
+			if (c == NULL) {
+				return NULL;
+			}
+		}
+		arena->cur = c;
+		arena->ptr = (char *) (c + 1);
+	}
+	p = arena->ptr;
+	arena->ptr += size;
+	return p;
+}
+
+/**
+ * @brief
+ * API to free all memory allocated from an arena, in O(1).
+ *
+ * @note
+ * The chunks are kept, and allocation starts over from the first of
+ * them, so an arena reused for similar work stops growing.
+ *
+ * @param[in]
+ *       arena: Arena to be reset.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+arenaReset(arena_t *arena)
+{
+	arena->cur = arena->first;
+	arena->ptr = (char *) (arena + 1);
+	return;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file      arena.h
+ * @brief     Include file for toy kernel arena allocator
+ *
+ * Arenas of memory with a common lifetime, layered over the toy kernel
+ * memory management.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/* Arena */
+typedef struct arena_ arena_t;
+
+arena_t *arenaCreate(int chunkSize);
+void arenaDestroy(arena_t *arena);
+void *arenaAlloc(arena_t *arena, int size);
+void arenaReset(arena_t *arena);
+
+#endif /* _ARENA_H_ */
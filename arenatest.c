@@ -0,0 +1,83 @@
+/**
+ * @file      arenatest.c
+ * @brief     Unit test for toy kernel arena allocator.
+ *
+ * Test out toy kernel arena allocator.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <mem.h>
+#include <arena.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char space[1*1024*1024] __attribute__ ((aligned (MEM_ALIGN)));
+
+int
+main(void)
+{
+	srandom(getpid());
+	{
+		arena_t *a;
+		char *ptr[1000], *first;
+		int i, sz[1000];
+		memStats_t st, st2;
+
+		memInit(space, sizeof(space));
+		memTcacheEnable(0);
+		a = arenaCreate(4096);
+		for(i=0; i<1000; i++) {
+			sz[i] = random() % 300;
+			ptr[i] = arenaAlloc(a, sz[i]);
+			assert(ptr[i] != 0);
+			assert(((uintptr_t) ptr[i] & (MEM_ALIGN - 1)) == 0);
+			memset(ptr[i], i, sz[i]);
+		}
+		for(i=0; i<1000; i++) { // No overlaps.
+			assert(sz[i] == 0 || ptr[i][0] == (char) i);
+			assert(sz[i] == 0 || ptr[i][sz[i]-1] == (char) i);
+		}
+		assert(arenaAlloc(a, 100000) != 0); // Larger than a chunk.
+		memStats(&st);
+		first = ptr[0];
+
+		/* Reset reuses the chunks. */
+		arenaReset(a);
+		for(i=0; i<1000; i++) {
+			ptr[i] = arenaAlloc(a, sz[i]);
+		}
+		assert(ptr[0] == first);
+		memStats(&st2);
+		assert(st2.usedBlocks == st.usedBlocks);
+		arenaDestroy(a);
+		memStats(&st);
+		assert(st.usedBlocks == 0 && st.freeBlocks == 1);
+		memTcacheEnable(1);
+	}
+	{
+		arena_t *a[3];
+		int i, j;
+
+		memInit(space, sizeof(space));
+		for(j=0; j<3; j++) {
+			a[j] = arenaCreate(100 + j * 4000);
+		}
+		for(i=0; i<100000; i++) {
+			j = random() % 3;
+			if (random() % 100 == 0) {
+				arenaReset(a[j]);
+			} else {
+				assert(arenaAlloc(a[j], random() % 200) != 0);
+			}
+		}
+		for(j=0; j<3; j++) {
+			arenaDestroy(a[j]);
+		}
+		assert(arenaAlloc(arenaCreate(0), 0) != 0);
+	}
+}
@@ -9,9 +9,18 @@
  * @copyright Copyright (c) 2016, Natarajan Venkataraman
  */
 
+#define _GNU_SOURCE		/* For mremap() */
 #include <mem.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #ifdef UNIT_TEST
 #include <assert.h>
 #endif /* UNIT_TEST */
@@ -19,48 +28,409 @@
 #define	TRUE	1
 #define	FALSE	0
 
+#ifndef MEM_COMPACT_HDR
 /* Some magic numbers we will use. Also indicates state of a memory block. */
 #define MAGIC_USED	0x4D454D55 /* 'MEMU' */
 #define MAGIC_FREE	0x4D454D46 /* 'MEMF' */
+#define MAGIC_BATCH	0x4D454D42 /* 'MEMB' - Being freed by a batch */
+#define MAGIC_REMOTE	0x4D454D52 /* 'MEMR' - In remote free queue */
+#define MAGIC_FENCE	0x4D454D5A /* 'MEMZ' - End of a region */
+#define MAGIC_LARGE	0x4D454D4C /* 'MEML' - Large block, see span_t */
+#define MAGIC_DEBUG	0x4D454D44 /* 'MEMD' - Debug block, see dbg_t */
+#define MAGIC_PROF	0x4D454D50 /* 'MEMP' - Sampled block, see prof_t */
 
-/* Memory control block (MCB) */
+/* Memory control block (MCB). The memory given out must be MEM_ALIGN
+ * aligned, so a block size is MEM_ALIGN - 8 modulo MEM_ALIGN, and the
+ * low 3 bits of "size" are free for flags.
+ */
 typedef struct mcb_ {
-	struct	mcb_	*prev;	/* Preceeding memory block - may be free or
-				 * in-use.
-				 */
 	uint32_t	magic;	/* Magic# and flag indicating in-use/free */
+	int	size;		/* Size of memory region | flags */
+} mcb_t;
+
+/* Header of a large block, which is a mapping of its own rather than
+ * a block of a region. Its last 8 bytes are laid out like mcb_t, so
+ * that the magic# of any block is at the same place.
+ */
+typedef struct span_ {
+	size_t	len;		/* Length of mapping */
+	uint32_t	magic;	/* MAGIC_LARGE */
+	int	size;		/* Size of memory region */
+} span_t;
+
+/* Header of a block of a heap with MEM_DEBUG_REDZONE, kept in front of
+ * the memory given out, which is followed by REDZONE bytes of CANARY.
+ * Its last 8 bytes are laid out like mcb_t, as those of span_t are.
+ */
+typedef struct dbg_ {
+	void	*site;		/* Return address of allocating call */
+	int	size;		/* Size of memory region */
+	uint8_t	front[12];	/* CANARY */
+	uint32_t	magic;	/* MAGIC_DEBUG */
+	int	nsize;		/* ~size, so that "size" is checked too */
+} dbg_t;
+
+/* Header of a block sampled by the heap profiler, kept in front of the
+ * memory given out. Its last 8 bytes are laid out like mcb_t.
+ */
+#define PROF_DEPTH	16	/* Frames kept of a sampled stack */
+typedef struct prof_ {
+	struct prof_	*next;	/* Next live sample */
+	struct prof_	*prev;	/* Previous live sample */
+	void	*stack[PROF_DEPTH];	/* Return addresses, innermost first,
+					 * NULL padded
+					 */
+	long	weight;		/* Bytes of allocation the sample stands for */
+	uint32_t	magic;	/* MAGIC_PROF */
 	int	size;		/* Size of memory region */
+} prof_t;
+
+/* Fields of an MCB. All access to them goes through these. */
+#define MCB_PINUSE_BIT		1U	/* Preceding block not free */
+#define MCB_MAGIC(m)		((m)->magic)
+#define MCB_SET_MAGIC(m, x)	((m)->magic = (x))
+#define MCB_SIZE(m)		((m)->size & ~7)
+#define MCB_SET_SIZE(m, s)	((m)->size = (s) | ((m)->size & 7))
+#define MCB_PINUSE(m)		((m)->size & MCB_PINUSE_BIT)
+#define MCB_SET_PINUSE(m)	((m)->size |= MCB_PINUSE_BIT)
+#define MCB_CLEAR_PINUSE(m)	((m)->size &= ~MCB_PINUSE_BIT)
+#else
+/* Compact MCBs take 4 bytes in place of 8, with no magic#. A block size
+ * is MEM_ALIGN - 4 modulo MEM_ALIGN, so it is kept with its low 4 bits
+ * (always 1100b) replaced by the state of the block, as a small code,
+ * and MCB_PINUSE_BIT. Detecting a corrupt MCB is left to the neighbour
+ * checks of memHeapSetCheck(), as a 3 bit code is easily forged.
+ */
+#define MAGIC_USED	1
+#define MAGIC_FREE	2
+#define MAGIC_BATCH	3	/* Being freed by a batch */
+#define MAGIC_REMOTE	4	/* In remote free queue */
+#define MAGIC_FENCE	5	/* End of a region */
+#define MAGIC_LARGE	6	/* Large block, see span_t */
+/* Debug and sampled blocks are not supported, as a state code does not
+ * tell them from garbage. These never match one.
+ */
+#define MAGIC_DEBUG	0xFFFFFFFFU
+#define MAGIC_PROF	0xFFFFFFFEU
+
+/* Memory control block (MCB) */
+typedef struct mcb_ {
+	uint32_t	head;	/* Size of memory region | flags | state */
 } mcb_t;
 
-/* Links used by MCBs in the freelist. This info is kept in the user data
+/* Header of a large block. Its last 4 bytes are laid out like mcb_t. */
+typedef struct span_ {
+	size_t	len;		/* Length of mapping */
+	int	size;		/* Size of memory region */
+	uint32_t	magic;	/* MAGIC_LARGE */
+} span_t;
+
+/* Header of a debug block, never made (see MAGIC_DEBUG) */
+typedef struct dbg_ {
+	void	*site;
+	int	size;
+	uint8_t	front[12];
+	int	nsize;
+	uint32_t	magic;
+} dbg_t;
+
+/* Header of a sampled block, never made (see MAGIC_PROF) */
+#define PROF_DEPTH	16
+typedef struct prof_ {
+	struct prof_	*next;
+	struct prof_	*prev;
+	void	*stack[PROF_DEPTH];
+	long	weight;
+	int	size;
+	uint32_t	magic;
+} prof_t;
+
+/* Fields of an MCB. All access to them goes through these. */
+#define MCB_PINUSE_BIT		8U	/* Preceding block not free */
+#define MCB_MAGIC_MASK		7U
+#define MCB_MAGIC(m)		((m)->head & MCB_MAGIC_MASK)
+#define MCB_SET_MAGIC(m, x)	((m)->head = ((m)->head & ~MCB_MAGIC_MASK) | \
+					     (x))
+#define MCB_SIZE(m)		((int) ((m)->head & ~15U) + MEM_ALIGN - \
+				 (int) sizeof(mcb_t))
+#define MCB_SET_SIZE(m, s)	((m)->head = ((uint32_t) (s) & ~15U) | \
+					     ((m)->head & 15U))
+#define MCB_PINUSE(m)		((m)->head & MCB_PINUSE_BIT)
+#define MCB_SET_PINUSE(m)	((m)->head |= MCB_PINUSE_BIT)
+#define MCB_CLEAR_PINUSE(m)	((m)->head &= ~MCB_PINUSE_BIT)
+#endif /* MEM_COMPACT_HDR */
+
+#ifndef MEM_COMPACT_HDR
+#define HEAP_SET_PINUSE(h, m)	MCB_SET_PINUSE(m)
+#define HEAP_CLEAR_PINUSE(h, m)	MCB_CLEAR_PINUSE(m)
+#else
+/* MCB_PINUSE_BIT of a block that follows one entering or leaving the
+ * free state. If the heap has an owner, that block may be in use and
+ * being claimed by another thread for the remote free queue (see
+ * remoteFree()), which swaps the state in the same word. The bit is then
+ * changed atomically, so as not to undo the claim. Other states are
+ * changed only by the owner, under the lock.
+ */
+#define PINUSE_SHARED(h, m)	((h)->owned &&				\
+				 ((__atomic_load_n(&(m)->head,		\
+						   __ATOMIC_RELAXED) &	\
+				   MCB_MAGIC_MASK) == MAGIC_USED))
+#define HEAP_SET_PINUSE(h, m)						\
+	do {								\
+		if (PINUSE_SHARED(h, m)) {				\
+			__atomic_fetch_or(&(m)->head, MCB_PINUSE_BIT,	\
+					  __ATOMIC_RELAXED);		\
+		} else {						\
+			MCB_SET_PINUSE(m);				\
+		}							\
+	} while (0)
+#define HEAP_CLEAR_PINUSE(h, m)						\
+	do {								\
+		if (PINUSE_SHARED(h, m)) {				\
+			__atomic_fetch_and(&(m)->head, ~MCB_PINUSE_BIT,	\
+					   __ATOMIC_RELAXED);		\
+		} else {						\
+			MCB_CLEAR_PINUSE(m);				\
+		}							\
+	} while (0)
+#endif /* MEM_COMPACT_HDR */
+
+/* MCB of the block after a block, which may be the fence of its region */
+#define MCB_AFTER(m)	((mcb_t *) ((char *) ((m) + 1) + MCB_SIZE(m)))
+
+/* A free block keeps its size in its last bytes (its foot), where the
+ * MCB after it finds it. So the preceding block of an MCB can be found
+ * only when MCB_PINUSE_BIT is clear, which is all that merging needs.
+ * Blocks in use carry neither a foot nor a link to the preceding block.
+ */
+#define MCB_FOOT(m)	(((int *) (m))[-1])	/* Foot of block before */
+#define MCB_PREV(m)	((mcb_t *) ((char *) (m) - MCB_FOOT(m)) - 1)
+
+/* Is a magic# that of a block in the block list */
+#define MAGIC_VALID(x)	(((x) == MAGIC_USED) || ((x) == MAGIC_FREE) || \
+			 ((x) == MAGIC_REMOTE))
+
+/* Links used by MCBs in a free bin. This info is kept in the user data
  * area of the memory block in order to keep size of MCB to minimum.
  */
 typedef struct freelist_links_ {
-	struct	mcb_	*larger;
-	struct	mcb_	*smaller;
+	struct	mcb_	*next;
+	struct	mcb_	*prev;
 } freelist_links_t;
 
-/* Minimum size of a free block (including MCB overhead) */
-#define MIN_FREE_BLOCK	(sizeof(mcb_t) + sizeof(freelist_links_t))
+/* Round up an address to a multiple of 'a', which is a power of 2 */
+#define ALIGN_UP(p, a)	((char *) (((uintptr_t) (p) + (a) - 1) & \
+				   ~((uintptr_t) (a) - 1)))
+
+/* Minimum size of a free block (including MCB overhead and foot) */
+#define MIN_FREE_BLOCK	(sizeof(mcb_t) + sizeof(freelist_links_t) + \
+			 sizeof(int))
+
+/* Free bins are indexed in two levels. The first level (FL) is the
+ * power-of-two size class, ie. floor(log2(size)), so 32 classes cover every
+ * possible (int) block size. In MEM_MODE_TLSF each class is further split
+ * into SL_COUNT linearly spaced second level (SL) bins. MEM_MODE_BINS uses
+ * only the first SL bin of every class.
+ */
+#define FL_COUNT	32
+#define SL_LOG2		4
+#define SL_COUNT	(1 << SL_LOG2)
+#define NBINS		(FL_COUNT * SL_COUNT)
+
+#define REMOTE_BATCH	64	/* Blocks merged per heapFreeBatch() by drain */
+#define FREE_BATCH	64	/* Blocks gathered per heapFreeBatch() by
+				 * memHeapFreeBatch(), when some are not
+				 * freed in the batch
+				 */
+
+#define HUGE_PAGE	(2UL * 1024 * 1024)	/* Size of a huge page */
+
+/* Debug blocks (see memHeapSetDebug()) */
+#define REDZONE		16	/* Bytes of CANARY after memory given out */
+#define CANARY		0xFD	/* Fill of redzones */
+#define SPAN_GUARD	1	/* In "len" of a span: ends with a guard page */
+
+/* Round down an address to a multiple of 'a', which is a power of 2 */
+#define ALIGN_DOWN(p, a)	((char *) ((uintptr_t) (p) & \
+					   ~((uintptr_t) (a) - 1)))
+
+/* Heap verification. A failed check is a corrupt heap, which is fatal. */
+#define CHECK_PERIOD	1024	/* Operations between sampled full walks */
+#ifdef UNIT_TEST
+#define CHECK_DEFAULT	MEM_CHECK_FULL
+#define CHECK_FAIL()	assert(0)
+#else
+#define CHECK_DEFAULT	MEM_CHECK_OFF
+#define CHECK_FAIL()	abort()
+#endif /* UNIT_TEST */
+
+/* Counters of a heap, maintained under its lock */
+typedef struct heapCounters_ {
+	long	allocs;		/* Blocks allocated */
+	long	frees;		/* Blocks freed */
+	long	failures;	/* Allocation requests that failed */
+	long	usedBytes;	/* Bytes in in-use blocks (excluding MCBs) */
+	long	usedBlocks;	/* Number of in-use blocks */
+	long	freeBlocks;	/* Number of free blocks */
+} heapCounters_t;
+
+/* Region of memory managed by a heap */
+typedef struct region_ {
+	struct region_	*next;	/* Next region, in increasing order of
+				 * address
+				 */
+	mcb_t	*mcb;	/* Linked-list of MCBs - free and used */
+	/* "mcb" is a linked-list with entries in increasing order of
+	 * address. This list has both the free and used memory blocks.
+	 * This makes it very efficient to merge freed blocks into a larger
+	 * sized free block.
+	 */
+
+	mcb_t	*endMem;	/* Address denoting end of memory. A fence MCB
+				 * (MAGIC_FENCE) is kept here, so that blocks
+				 * of different regions are never merged.
+				 */
+} region_t;
+
+/* Heap. Holds all the state needed to manage one or more regions of
+ * memory, so that independent heaps can be used side by side.
+ */
+struct memHeap_ {
+	pthread_mutex_t	lock;	/* Guards the heap data-strs below */
+
+	region_t	*regions;	/* Regions, in increasing order of
+					 * address
+					 */
+	region_t	region0;	/* Region the heap was set up with */
+	long	capacity;	/* Bytes from first MCB to "endMem", over all
+				 * regions
+				 */
+	heapCounters_t	cnt;	/* Statistics */
+
+	int	largeMin;	/* Size from which blocks are mapped as
+				 * spans, 0 if never
+				 */
+	long	largeBlocks;	/* Number of spans (atomic) */
+	long	largeBytes;	/* Bytes mapped by spans (atomic) */
+
+	memMode_t mode;		/* Free block management engine in use */
+	memPolicy_t policy;	/* Placement policy (MEM_MODE_BINS only) */
+	memCheck_t check;	/* Verification done on every operation */
+	int	debug;		/* MEM_DEBUG_* flags */
+	int	checkOps;	/* Operations since last MEM_CHECK_SAMPLED walk */
+
+	int	owned;		/* Does the heap have an owner thread */
+	pthread_t owner;	/* Owner thread, if "owned" */
+	mcb_t	*remote __attribute__ ((aligned (64)));
+	/* Blocks freed by threads other than the owner, linked through
+	 * the "next" of their freelist_links_t. Pushed without the lock,
+	 * and taken off as a whole, under the lock, by the owner.
+	 */
+
+	uint32_t flMap;		/* Bit 'f' is set iff slMap[f] is non-zero */
+	uint32_t slMap[FL_COUNT];	/* Bit 's' of slMap[f] is set iff
+					 * freeBins[f * SL_COUNT + s] is
+					 * non-empty
+					 */
+	mcb_t	*freeBins[NBINS];	/* Segregated lists of free MCBs */
+	/* A free block lives in the bin of its size class. Blocks within a
+	 * bin are in no particular order, so insertion and removal are
+	 * O(1), and a suitable non-empty bin is found with at most two
+	 * bit-scans of the bitmaps.
+	 */
+} __attribute__ ((aligned (64)));	/* Heaps must not share cache lines */
+
+memHeap_t defaultHeap = {		/* Heap used by memAlloc()/memFree() */
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Small allocations are served by a per-thread front-end of magazines
+ * (Bonwick & Adams), so that they need not take the lock of the default
+ * heap. A magazine is a stack of free blocks of one size class. Each
+ * thread holds a loaded and a previous magazine per class; when both are
+ * exhausted (on alloc) or both are full (on free), a whole magazine is
+ * exchanged with the shared depot under "depotLock". Blocks in magazines
+ * remain MAGIC_USED as far as the heap is concerned.
+ */
+#define TC_GRAIN	16	/* Spacing of size classes */
+#define TC_CLASSES	16	/* Number of size classes */
+#define TC_MAX_SIZE	(TC_CLASSES * TC_GRAIN)	/* Largest size cached */
+#define MAG_SIZE	32	/* Blocks held by a magazine */
+#define DEPOT_MAX	8	/* Full magazines kept in depot per class */
 
-mcb_t	*mcb;	/* Linked-list of MCBs - free and used */
-/* "mcb" is a linked-list with entries in increasing order of address.
- * This list has both the free and used memory blocks. This makes it very
- * efficient to merge freed blocks into a larger sized free block.
+typedef struct magazine_ {
+	struct magazine_	*next;	/* Link in depot lists */
+	int	count;			/* Number of blocks in objs[] */
+	void	*objs[MAG_SIZE];
+} magazine_t;
+
+/* Statistics of a thread cache. These are written only by the owning
+ * thread, without a lock, and summed over all threads by memStats().
+ * Blocks move between threads through the depot, so only the sums are
+ * meaningful.
+ */
+typedef struct tcacheCounters_ {
+	long	allocs;		/* Allocations served from the cache */
+	long	frees;		/* Frees taken into the cache */
+	long	flushed;	/* Blocks flushed from the cache to the heap */
+	long	cachedBytes;	/* Bytes taken in less bytes given out */
+} tcacheCounters_t;
+
+/* Update a thread cache counter. A relaxed store is a plain store, but
+ * lets memStats() read the counter while the owner updates it.
  */
+#define TC_STAT_ADD(x, v)	__atomic_store_n(&(x), (x) + (v), \
+						 __ATOMIC_RELAXED)
+
+/* Per-thread cache */
+typedef struct tcache_ {
+	uint32_t	gen;	/* Value of "heapGen" when cache was set up */
+	int	registered;	/* Destructor armed for this thread */
+	magazine_t	*loaded[TC_CLASSES];
+	magazine_t	*prev[TC_CLASSES];
+	tcacheCounters_t	cnt;	/* Statistics */
+	struct tcache_	*next;	/* Link in "tcacheList" */
+	struct tcache_	*prevTc;	/* Link in "tcacheList" */
+	long	profLeft;	/* Bytes to allocate before next sample */
+	uint32_t	profGen;	/* Value of "profGen" for "profLeft" */
+	uint64_t	profSeed;	/* State of sample spacing generator */
+} tcache_t;
 
-mcb_t	*endMem;	/* Address denoting end of memory */
+/* Depot of magazines for one size class */
+typedef struct depot_ {
+	magazine_t	*full;	/* Full magazines */
+	magazine_t	*empty;	/* Empty magazines */
+	int	nfull;		/* Number of magazines in "full" */
+} depot_t;
 
-mcb_t	*freelist;	/* Linked-list of free MCBs */
-/* "freelist" is a linked-list with entries in decreasing order of
- * size of the memory blocks.
+static __thread tcache_t tcache;
+depot_t	depot[TC_CLASSES];
+pthread_mutex_t	depotLock = PTHREAD_MUTEX_INITIALIZER;
+uint32_t	heapGen;	/* Bumped every time the default heap is
+				 * initialized
+				 */
+int	tcacheOn = TRUE;	/* Is the magazine front-end in use */
+
+/* Heap profiler. memAlloc() samples an allocation after a random number
+ * of bytes, exponentially distributed with mean "profRate", so that a
+ * sample stands for "profRate" bytes whatever the allocation sizes.
  */
+long	profRate;		/* Mean bytes between samples, 0 if off */
+uint32_t	profGen;	/* Bumped every time "profRate" is set */
+prof_t	*profLive;		/* Samples not freed yet, under "profLock" */
+pthread_mutex_t	profLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t	tcacheKey;	/* Flushes thread cache on thread exit */
+pthread_once_t	tcacheKeyOnce = PTHREAD_ONCE_INIT;
+tcache_t	*tcacheList;	/* Caches of live threads, for memStats() */
+tcacheCounters_t tcacheRetired;	/* Counters of exited threads */
+pthread_mutex_t	tcacheListLock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief
  * Get the addr of the MCB structure of the immediate next memory block.
  *
  * @param[in]
+ *       h: Heap.
  *       m: Pointer to MCB whose next memory block MCB addr is needed.
  *
  * @param[out]
@@ -71,12 +441,12 @@ mcb_t	*freelist;	/* Linked-list of free MCBs */
  *       - Failure : NULL
  */
 mcb_t *
-mcbNext(mcb_t *m)
+mcbNext(memHeap_t *h, mcb_t *m)
 {
 	mcb_t *next;
 
-	next = (mcb_t *) ((char *) m + sizeof(*m) + m->size);
-	if (next == endMem) {
+	next = (mcb_t *) ((char *) m + sizeof(*m) + MCB_SIZE(m));
+	if (MCB_MAGIC(next) == MAGIC_FENCE) {
 		next = NULL;
 	}
 	return next;
@@ -103,17 +473,43 @@ mcbAddr(mcb_t *m)
 
 /**
  * @brief
- * Insert an MCB into the sorted freelist.
+ * Get the index of the free bin which holds blocks of a given size.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Size of memory block.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Index of bin in freeBins[].
+ */
+static int
+binIndex(memHeap_t *h, int size)
+{
+	int	fl, sl;
+
+	fl = 31 - __builtin_clz((uint32_t) size);
+	sl = 0;
+	if ((h->mode == MEM_MODE_TLSF) && (fl >= SL_LOG2)) {
+		sl = (size >> (fl - SL_LOG2)) & (SL_COUNT - 1);
+	}
+	return (fl * SL_COUNT + sl);
+}
+
+/**
+ * @brief
+ * Insert an MCB into the free bin of its size class.
  *
  * @note
- * A very simple O(n) sort method is used here. A more runtime efficient
- * one would be 'skiplist'. However, that would result in a bloated mcb_t.
- * A bloated mcb_t would result in poor memory management efficiency (ie.
- * how much of the memory space provided to us for managing is actually
- * available to users of our memory management code.)
+ * The block is pushed at the head of its bin. This is O(1), as against
+ * the O(n) walk needed to keep a single size-sorted freelist. The block
+ * must have its final size, as it is also given its foot here.
  *
  * @param[in]
- *       m: MCB to be inserted into freelist.
+ *       h: Heap.
+ *       m: MCB to be inserted into a free bin.
  *
  * @param[out]
  *       None.
@@ -122,42 +518,35 @@ mcbAddr(mcb_t *m)
  *       - None.
  */
 static void
-insertFree(mcb_t *m)
+insertFree(memHeap_t *h, mcb_t *m)
 {
-	mcb_t *l, *s;
-	freelist_links_t *mf, *lf, *sf;
+	freelist_links_t *mf, *hf;
+	int	b;
 
-	/* Find where to insert 'm'. */
-	l = NULL;
-	s = freelist;
-	while (s && (m->size < s->size)) {
-		l = s;
-		sf = mcbAddr(s);
-		s = sf->smaller;
-	}
-	/* Insert 'm' between 'l' and 's'. */
+	b = binIndex(h, MCB_SIZE(m));
 	mf = mcbAddr(m);
-	mf->larger = l;
-	if (l) {
-		lf = mcbAddr(l);
-		lf->smaller = m;
-	} else {
-		freelist = m;
-	}
-	mf->smaller = s;
-	if (s) {
-		sf = mcbAddr(s);
-		sf->larger = m;
+	mf->prev = NULL;
+	mf->next = h->freeBins[b];
+	if (h->freeBins[b]) {
+		hf = mcbAddr(h->freeBins[b]);
+		hf->prev = m;
 	}
+	h->freeBins[b] = m;
+	h->slMap[b / SL_COUNT] |= (1U << (b % SL_COUNT));
+	h->flMap |= (1U << (b / SL_COUNT));
+	h->cnt.freeBlocks++;
+	MCB_FOOT(MCB_AFTER(m)) = MCB_SIZE(m);
+	HEAP_CLEAR_PINUSE(h, MCB_AFTER(m));
 	return;
 }
 
 /**
  * @brief
- * Remove a MCB from the freelist.
+ * Remove a MCB from its free bin.
  *
  * @param[in]
- *       m: The MCB to be removed from freelist.
+ *       h: Heap.
+ *       m: The MCB to be removed from its free bin.
  *
  * @param[out]
  *       None.
@@ -166,346 +555,3791 @@ insertFree(mcb_t *m)
  *       - None.
  */
 static void
-removeFree(mcb_t *m)
+removeFree(memHeap_t *h, mcb_t *m)
 {
 	freelist_links_t *mf, *f;
+	int	b;
 
+	b = binIndex(h, MCB_SIZE(m));
 	mf = mcbAddr(m);
-	if (mf->smaller) {
-		f = mcbAddr(mf->smaller);
-		f->larger = mf->larger;
+	if (mf->next) {
+		f = mcbAddr(mf->next);
+		f->prev = mf->prev;
 	}
-	if (mf->larger) {
-		f = mcbAddr(mf->larger);
-		f->smaller = mf->smaller;
+	if (mf->prev) {
+		f = mcbAddr(mf->prev);
+		f->next = mf->next;
 	} else {
-		freelist = mf->smaller;
+		h->freeBins[b] = mf->next;
+		if (h->freeBins[b] == NULL) {
+			h->slMap[b / SL_COUNT] &= ~(1U << (b % SL_COUNT));
+			if (h->slMap[b / SL_COUNT] == 0) {
+				h->flMap &= ~(1U << (b / SL_COUNT));
+			}
+		}
 	}
-	mf->smaller = mf->larger = NULL;
+	mf->next = mf->prev = NULL;
+	h->cnt.freeBlocks--;
+	HEAP_SET_PINUSE(h, MCB_AFTER(m));
 	return;
 }
 
-#ifdef UNIT_TEST
 /**
  * @brief
- * Do sanity test of the data-strs used by this memory management module.
+ * Find a free block to satisfy an allocation request (MEM_MODE_BINS,
+ * MEM_FIT_WORST).
+ *
+ * @note
+ * We retain the worst-fit method at the granularity of size classes:
+ * allocation is done from the highest non-empty bin, which is found
+ * in O(1) from "flMap". The head of that bin is used if it is large
+ * enough; only when the request falls in the same size class as the
+ * largest free blocks do we have to look further down that one bin.
  *
  * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes needed (already rounded up).
+ *
+ * @param[out]
  *       None.
  *
+ * @return
+ *       - Success : Free MCB with at least 'size' bytes
+ *       - Failure : NULL
+ */
+static mcb_t *
+findFreeWorst(memHeap_t *h, int size)
+{
+	mcb_t	*m;
+	freelist_links_t *mf;
+
+	if (h->flMap == 0) {
+		return NULL;
+	}
+	m = h->freeBins[(31 - __builtin_clz(h->flMap)) * SL_COUNT];
+	while (m && (MCB_SIZE(m) < size)) {
+		mf = mcbAddr(m);
+		m = mf->next;
+	}
+	return m;
+}
+
+/**
+ * @brief
+ * Find a free block to satisfy an allocation request (MEM_MODE_BINS,
+ * MEM_FIT_BEST).
+ *
+ * @note
+ * The smallest block that fits is either in the bin of the request's
+ * size class, or is the smallest block of the next non-empty bin (every
+ * block of which fits). So at most two bins are walked.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes needed (already rounded up).
+ *
  * @param[out]
  *       None.
  *
  * @return
- *       - None: on success
- *       - Assert fail: on failure
+ *       - Success : Free MCB with at least 'size' bytes
+ *       - Failure : NULL
  */
-static void
-sanityCheck(void)
+static mcb_t *
+findFreeBest(memHeap_t *h, int size)
 {
-	mcb_t *m, *next;
-	freelist_links_t *mf, *f;
+	mcb_t	*m, *best;
+	freelist_links_t *mf;
+	uint32_t map;
+	int	fl;
 
-	m = mcb;
-	while (m) {
+	best = NULL;
+	fl = 31 - __builtin_clz((uint32_t) size);
+	for (m = h->freeBins[fl * SL_COUNT]; m; m = mf->next) {
 		mf = mcbAddr(m);
-		/* MCB must have a valid magic#. */
-		if ((m->magic != MAGIC_USED) && (m->magic != MAGIC_FREE)) {
-			assert(0);
-		}
-		/* First element will have 'prev' as NULL. */
-		if ((m->prev == NULL) && (mcb != m)) {
-			assert(0);
-		}
-		/* Address in successive MCBs must be increasing. */
-		next = mcbNext(m);
-		if (next && (next <= m)) {
-			assert(0);
-		}
-		/* Check if linked-list prev/next are sane. */
-		if (m->prev) {
-			if (mcbNext(m->prev) != m) {
-				assert(0);
-			}
-		} else {
-			if (mcb != m) {
-				assert(0);
-			}
-		}
-		if (next) {
-			if (next->prev != m) {
-				assert(0);
-			}
-		}
-		if (m->magic == MAGIC_FREE) {
-			/* If no MCB is larger than this one, it must be at
-			 * head of freelist.
-			 */
-			if (!mf->larger && (freelist != m)) {
-				assert(0);
-			}
-			if (mf->larger) {
-				if (mf->larger->magic != MAGIC_FREE) {
-					assert(0);
-				}
-			}
-			if (mf->smaller) {
-				if (mf->smaller->magic != MAGIC_FREE) {
-					assert(0);
-				}
-			}
-			/* The larger MCB must have a larger (or same) size */
-			if (mf->larger && (mf->larger->size < m->size)) {
-				assert(0);
-			}
-			/* The smaller MCB must have smaller (or same) size */
-			if (mf->smaller && (mf->smaller->size > m->size)) {
-				assert(0);
-			}
-			/* The must not be 2 contiguous free memory blocks. */
-			if (m->prev && (m->prev->magic != MAGIC_USED)) {
-				assert(0);
-			}
-			if (next && (next->magic != MAGIC_USED)) {
-				assert(0);
-			}
+		if ((MCB_SIZE(m) >= size) &&
+		    (!best || (MCB_SIZE(m) < MCB_SIZE(best)))) {
+			best = m;
+			if (MCB_SIZE(m) == size) break;
 		}
-		m = next;
+	}
+	if (best) {
+		return best;
 	}
 
-	m = freelist;
-	while (m) {
+	map = (fl < FL_COUNT - 1) ? (h->flMap & (~0U << (fl + 1))) : 0;
+	if (map == 0) {
+		return NULL;
+	}
+	for (m = h->freeBins[__builtin_ctz(map) * SL_COUNT]; m; m = mf->next) {
 		mf = mcbAddr(m);
-		if (m->magic != MAGIC_FREE) {
-			assert(0);
-		}
-		if (mf->smaller) {
-			if (mf->smaller->magic != MAGIC_FREE) {
-				assert(0);
-			}
-			if (m->size < mf->smaller->size) {
-				assert(0);
-			}
-			f = mcbAddr(mf->smaller);
-			if (f->larger != m) {
-				assert(0);
-			}
-		}
-		if (mf->larger) {
-			f = mcbAddr(mf->larger);
-			if (f->smaller != m) {
-				assert(0);
-			}
-		} else {
-			if (freelist != m) {
-				assert(0);
-			}
+		if (!best || (MCB_SIZE(m) < MCB_SIZE(best))) {
+			best = m;
 		}
-		m = mf->smaller;
 	}
-
-	return;
+	return best;
 }
-#endif /* UNIT_TEST */
 
 /**
  * @brief
- * Initialize a region of memory that needs to be managed.
+ * Find a free block to satisfy an allocation request (MEM_MODE_BINS,
+ * MEM_FIT_FIRST).
  *
  * @note
- * This function MUST be called before memAlloc() and memFree()
- * API functions are invoked.
+ * Address-ordered first-fit: the lowest addressed block that fits.
+ * Only bins of the request's size class and above are looked at, but
+ * all the blocks in them are, so this is O(number of free blocks).
  *
  * @param[in]
- *       addr: Start address of region of memory to be managed.
- *       size: Size of region of memory to be managed.
+ *       h: Heap.
+ *       size: Number of bytes needed (already rounded up).
  *
  * @param[out]
- *       None
+ *       None.
  *
  * @return
- *       - None
+ *       - Success : Free MCB with at least 'size' bytes
+ *       - Failure : NULL
  */
-void
-memInit(void *addr, int size)
+static mcb_t *
+findFreeFirst(memHeap_t *h, int size)
 {
-	mcb_t	*m;
+	mcb_t	*m, *first;
+	freelist_links_t *mf;
+	uint32_t map;
+	int	fl;
 
-	/* Mark entire region as free. */
-	m = (mcb_t *) addr;
-	m->size = size - sizeof(mcb_t);
-	m->magic = MAGIC_FREE;
-	m->prev = NULL;
-	mcb = m;
-	endMem = (mcb_t *) ((char *) addr + size);
-	freelist = NULL;
-	insertFree(m);
-#ifdef UNIT_TEST
-	sanityCheck();
-#endif /* UNIT_TEST */
-	return;
+	first = NULL;
+	fl = 31 - __builtin_clz((uint32_t) size);
+	map = h->flMap & (~0U << fl);
+	while (map) {
+		fl = __builtin_ctz(map);
+		map &= map - 1;
+		for (m = h->freeBins[fl * SL_COUNT]; m; m = mf->next) {
+			mf = mcbAddr(m);
+			if ((MCB_SIZE(m) >= size) && (!first || (m < first))) {
+				first = m;
+			}
+		}
+	}
+	return first;
 }
 
 /**
  * @brief
- * API to allocate memory.
+ * Find a free block to satisfy an allocation request (MEM_MODE_TLSF).
  *
  * @note
- * We use the worst-fit method wherein the allocation is done
- * from the memory block of largest size. For better performance
- * we maintain a sorted linked-list in decreasing size of memory
- * blocks.
+ * Two-Level Segregated Fit. The request size is rounded up to the start
+ * of the next SL bin, so that every block in that bin or any higher bin
+ * is large enough. The first non-empty such bin is then found with one
+ * find-first-set on the SL bitmap of the request's class and, failing
+ * that, one on "flMap" followed by one on the SL bitmap of the class
+ * found. No list is ever walked, so the worst case is O(1).
+ *
+ * Since rounding up can skip over a block that would have fit, the head
+ * of the request's own bin is also tried (still O(1)) before failing.
  *
  * @param[in]
- *       size: Number of bytes of memory to be allocated.
+ *       h: Heap.
+ *       size: Number of bytes needed (already rounded up).
  *
  * @param[out]
  *       None.
  *
  * @return
- *       - On successful allocation, pointer to start of memory
- *         area which has at least 'size' bytes of memory.
- *       - On failure, NULL is returned.
+ *       - Success : Free MCB with at least 'size' bytes
+ *       - Failure : NULL
  */
-void *
-memAlloc(int size)
+static mcb_t *
+findFreeTlsf(memHeap_t *h, int size)
 {
-	mcb_t	*m, *n, *next;
-	freelist_links_t *nf;
-	int	balance;
+	uint32_t r, map;
+	int	fl, sl, b;
 
-	/* Any memory block must be able to hold the links needed for
-	 * memory block in freelist.
-	 */
-	if (size < sizeof(freelist_links_t)) {
-		size = sizeof(freelist_links_t);
+	r = size;
+	fl = 31 - __builtin_clz(r);
+	sl = 0;
+	if (fl >= SL_LOG2) {
+		/* Round up to start of next SL bin. */
+		r += (1U << (fl - SL_LOG2)) - 1;
+		fl = 31 - __builtin_clz(r);
+		sl = (r >> (fl - SL_LOG2)) & (SL_COUNT - 1);
 	}
-	/* Align size to size of integer */
-	size = (size + sizeof(int) - 1) & ~(sizeof(int) - 1);
 
-	m = freelist;
-	if (!m || m->size < size) {
-		return NULL;
+	map = h->slMap[fl] & (~0U << sl);
+	if (map == 0) {
+		map = (fl < FL_COUNT - 1) ? (h->flMap & (~0U << (fl + 1))) : 0;
+		if (map == 0) {
+			b = binIndex(h, size);
+			if (h->freeBins[b] &&
+			    (MCB_SIZE(h->freeBins[b]) >= size)) {
+				return h->freeBins[b];
+			}
+			return NULL;
+		}
+		fl = __builtin_ctz(map);
+		map = h->slMap[fl];
 	}
+	sl = __builtin_ctz(map);
+	return h->freeBins[fl * SL_COUNT + sl];
+}
 
-	/* This memory block is free and has required space
-	 * to allocate for this memory allocation request.
-	 * Split this block into a used and a free block.
-	 */
-	balance = m->size - size;
-
-	/* New free block must be at least a certain
-	 * minimum size.
-	 */
-	if (balance > MIN_FREE_BLOCK) {
-		/* Create a new free block of smaller size */
-		n = (mcb_t *) ((char *) mcbAddr(m) + size);
-		n->prev = m;
-		next = mcbNext(m);
-		if (next) {
-			next->prev = n;
-		}
-		n->magic = MAGIC_FREE;
-		n->size = balance - sizeof(*m);
-		nf = mcbAddr(n);
-		nf->smaller = nf->larger = NULL;
-		insertFree(n);
-	} else {
-		/* Allocate this whole block. */
-		size = size + balance;
+/**
+ * @brief
+ * Find a free block to satisfy an allocation request, as per the engine
+ * and placement policy of the heap.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes needed (already rounded up).
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Free MCB with at least 'size' bytes
+ *       - Failure : NULL
+ */
+static mcb_t *
+findFree(memHeap_t *h, int size)
+{
+	if (h->mode == MEM_MODE_TLSF) {
+		return findFreeTlsf(h, size);
+	}
+	switch (h->policy) {
+	case MEM_FIT_BEST:
+		return findFreeBest(h, size);
+	case MEM_FIT_FIRST:
+		return findFreeFirst(h, size);
+	default:
+		return findFreeWorst(h, size);
 	}
-
-	removeFree(m);
-
-	/* Mark current block as in use. */
-	m->magic = MAGIC_USED;
-	m->size = size; /* Set to size allocated */
-#ifdef UNIT_TEST
-	sanityCheck();
-#endif /* UNIT_TEST */
-	return (mcbAddr(m));
 }
 
 /**
  * @brief
- * API to free memory.
- *
- * @note
- * Since the memory block is contiguous with the memory allocated,
- * the algorithm to free is quite efficient.
+ * Do sanity test of the data-strs used by this memory management module.
+ * This walks every block and every free bin of the heap, so it is O(n).
  *
  * @param[in]
- *       addr: Start address of memory to be freed back.
- *             The 'addr' must be same as what was returned by
- *             memAlloc().
+ *       h: Heap.
  *
  * @param[out]
  *       None.
  *
  * @return
- *       - None.
+ *       - None: on success
+ *       - Abort (assert fail with UNIT_TEST): on failure
  */
-void
-memFree(void *addr)
+static void
+sanityCheck(memHeap_t *h)
 {
-	mcb_t	*m, *next, *nnext;
-	freelist_links_t *mf;
-
-	if (!addr) return;
-
-	/* We expect MCB to be just above the addr.
-	 * If MCB is not present it means a wrong address has been
-	 * passed for freeing.
-	 */
-	m = (mcb_t *) (addr - sizeof(*m));
-	if (m->magic != MAGIC_USED) {
-		/* Sanity failed! */
-		return;
-	}
+	region_t *r;
+	mcb_t *m, *prev, *next;
+	freelist_links_t *mf, *f;
+	long	nused, usedBytes, capacity;
+	int	b, nfree;
 
-	if (m) {
-		/* Mark block as free */
-		m->magic = MAGIC_FREE;
-		mf = mcbAddr(m);
-		mf->smaller = mf->larger = NULL;
-
-		/* Merge with preceeding block, if possible */
-		if (m->prev && (m->prev->magic == MAGIC_FREE)) {
-			m->magic = 0;
-			m->prev->size += m->size + sizeof(*m);
-			next = mcbNext(m);
-			if (next) {
-				next->prev = m->prev;
+	nfree = 0;
+	nused = usedBytes = capacity = 0;
+	for (r = h->regions; r; r = r->next) {
+		/* Regions must be in order, and must not overlap. */
+		if (r->next && (r->next->mcb <= r->endMem)) {
+			CHECK_FAIL();
+		}
+		if (MCB_MAGIC(r->endMem) != MAGIC_FENCE) {
+			CHECK_FAIL();
+		}
+		capacity += (char *) r->endMem - (char *) r->mcb;
+		m = r->mcb;
+		prev = NULL;
+		while (m) {
+			/* MCB must have a valid magic#. */
+			if (!MAGIC_VALID(MCB_MAGIC(m))) {
+				CHECK_FAIL();
 			}
-			m = m->prev;
-			/* Since size of 'm' is increased, put it back
-			 * into freelist in sorted order.
+			/* Only a block after a free block, which is never the
+			 * first block, may find its preceding block.
 			 */
-			removeFree(m);
-			insertFree(m);
-		} else {
-			insertFree(m);
-		}
-
-		/* Merge with succeeding block, if possible */
-		next = mcbNext(m);
-		if (next && (next->magic == MAGIC_FREE)) {
-			removeFree(next);
-			next->magic = 0;
-			m->size += sizeof(*m) + next->size;
-			nnext = mcbNext(next);
-			if (nnext) {
-				nnext->prev = m;
+			if (!MCB_PINUSE(m) !=
+			    (prev && (MCB_MAGIC(prev) == MAGIC_FREE))) {
+				CHECK_FAIL();
 			}
-			/* Since size of 'm' is increased, put it back
-			 * into freelist in sorted order.
-			 */
-			removeFree(m);
-			insertFree(m);
+			if (!MCB_PINUSE(m) && (MCB_PREV(m) != prev)) {
+				CHECK_FAIL();
+			}
+			/* Memory of every block must be aligned. */
+			if (((uintptr_t) mcbAddr(m) |
+			     (MCB_SIZE(m) + sizeof(*m))) & (MEM_ALIGN - 1)) {
+				CHECK_FAIL();
+			}
+			/* Address in successive MCBs must be increasing. */
+			next = mcbNext(h, m);
+			if (next && (next <= m)) {
+				CHECK_FAIL();
+			}
+			if (MCB_MAGIC(m) == MAGIC_FREE) {
+				nfree++;
+				/* The must not be 2 contiguous free memory
+				 * blocks.
+				 */
+				if (prev && (MCB_MAGIC(prev) == MAGIC_FREE)) {
+					CHECK_FAIL();
+				}
+				if (next && (MCB_MAGIC(next) == MAGIC_FREE)) {
+					CHECK_FAIL();
+				}
+			} else {
+				nused++;
+				usedBytes += MCB_SIZE(m);
+			}
+			prev = m;
+			m = next;
+		}
+		/* Fence must know if the last block is free. */
+		if (MCB_AFTER(prev) != r->endMem) {
+			CHECK_FAIL();
+		}
+		if (!MCB_PINUSE(r->endMem) != (MCB_MAGIC(prev) == MAGIC_FREE)) {
+			CHECK_FAIL();
 		}
 	}
-#ifdef UNIT_TEST
-	sanityCheck();
-#endif /* UNIT_TEST */
+	if (capacity != h->capacity) {
+		CHECK_FAIL();
+	}
+	/* Counters must agree with the blocks. */
+	if ((nused != h->cnt.usedBlocks) || (usedBytes != h->cnt.usedBytes) ||
+	    (nfree != h->cnt.freeBlocks)) {
+		CHECK_FAIL();
+	}
+
+	for (b = 0; b < NBINS; b++) {
+		/* Bitmaps must reflect which bins are non-empty. */
+		if (!!(h->slMap[b / SL_COUNT] & (1U << (b % SL_COUNT))) !=
+		    (h->freeBins[b] != NULL)) {
+			CHECK_FAIL();
+		}
+		if (!!(h->flMap & (1U << (b / SL_COUNT))) !=
+		    (h->slMap[b / SL_COUNT] != 0)) {
+			CHECK_FAIL();
+		}
+		m = h->freeBins[b];
+		while (m) {
+			mf = mcbAddr(m);
+			if (MCB_MAGIC(m) != MAGIC_FREE) {
+				CHECK_FAIL();
+			}
+			/* Block must be in the bin of its size class. */
+			if (binIndex(h, MCB_SIZE(m)) != b) {
+				CHECK_FAIL();
+			}
+			if (mf->next) {
+				f = mcbAddr(mf->next);
+				if (f->prev != m) {
+					CHECK_FAIL();
+				}
+			}
+			if (!mf->prev && (h->freeBins[b] != m)) {
+				CHECK_FAIL();
+			}
+			nfree--;
+			m = mf->next;
+		}
+	}
+	/* Every free block must be in exactly one bin. */
+	if (nfree != 0) {
+		CHECK_FAIL();
+	}
+
+	return;
+}
+
+/**
+ * @brief
+ * Do sanity test of a memory block and its links to its neighbours, in
+ * the block list and (for a free block) in its free bin. This is O(1).
+ *
+ * @param[in]
+ *       h: Heap.
+ *       m: MCB of block to be checked.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None: on success
+ *       - Abort (assert fail with UNIT_TEST): on failure
+ */
+static void
+localCheck(memHeap_t *h, mcb_t *m)
+{
+	mcb_t	*prev, *next;
+	freelist_links_t *mf, *f;
+
+	if (!MAGIC_VALID(MCB_MAGIC(m))) {
+		CHECK_FAIL();
+	}
+	if (((uintptr_t) mcbAddr(m) | (MCB_SIZE(m) + sizeof(*m))) &
+	    (MEM_ALIGN - 1)) {
+		CHECK_FAIL();
+	}
+	next = mcbNext(h, m);
+	if (!MCB_PINUSE(m)) {
+		prev = MCB_PREV(m);
+		if ((prev >= m) || (mcbNext(h, prev) != m)) {
+			CHECK_FAIL();
+		}
+		if (MCB_MAGIC(prev) != MAGIC_FREE) {
+			CHECK_FAIL();
+		}
+	}
+	if (next) {
+		if (next <= m) {
+			CHECK_FAIL();
+		}
+		if (!MAGIC_VALID(MCB_MAGIC(next))) {
+			CHECK_FAIL();
+		}
+		if (!MCB_PINUSE(next) != (MCB_MAGIC(m) == MAGIC_FREE)) {
+			CHECK_FAIL();
+		}
+		if (!MCB_PINUSE(next) && (MCB_FOOT(next) != MCB_SIZE(m))) {
+			CHECK_FAIL();
+		}
+	}
+	if (MCB_MAGIC(m) == MAGIC_FREE) {
+		/* Free block must have used neighbours and sane bin links. */
+		if (!MCB_PINUSE(m) ||
+		    (next && (MCB_MAGIC(next) == MAGIC_FREE))) {
+			CHECK_FAIL();
+		}
+		mf = mcbAddr(m);
+		if (mf->next) {
+			f = mcbAddr(mf->next);
+			if ((MCB_MAGIC(mf->next) != MAGIC_FREE) ||
+			    (f->prev != m)) {
+				CHECK_FAIL();
+			}
+		}
+		if (mf->prev) {
+			f = mcbAddr(mf->prev);
+			if ((MCB_MAGIC(mf->prev) != MAGIC_FREE) ||
+			    (f->next != m)) {
+				CHECK_FAIL();
+			}
+		} else if (h->freeBins[binIndex(h, MCB_SIZE(m))] != m) {
+			CHECK_FAIL();
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Verify a block and its neighbours before an operation unlinks or
+ * merges any of them, unless verification is off. A corrupt MCB is then
+ * caught before its links or foot are written through, not after.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       m: MCB of block the operation starts with.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None: on success
+ *       - Abort (assert fail with UNIT_TEST): on failure
+ */
+static void
+heapPreCheck(memHeap_t *h, mcb_t *m)
+{
+	mcb_t	*next;
+
+	if (h->check == MEM_CHECK_OFF) {
+		return;
+	}
+	/* Checks the neighbours are where 'm' says, before they are used. */
+	localCheck(h, m);
+	if (!MCB_PINUSE(m)) {
+		localCheck(h, MCB_PREV(m));
+	}
+	next = mcbNext(h, m);
+	if (next) {
+		localCheck(h, next);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Verify a heap after an operation, as per its verification level.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       m: MCB of block the operation ended with, or NULL.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None: on success
+ *       - Abort (assert fail with UNIT_TEST): on failure
+ */
+static void
+heapCheck(memHeap_t *h, mcb_t *m)
+{
+	switch (h->check) {
+	case MEM_CHECK_OFF:
+		break;
+	case MEM_CHECK_LOCAL:
+		if (m) {
+			localCheck(h, m);
+		}
+		break;
+	case MEM_CHECK_SAMPLED:
+		if (m) {
+			localCheck(h, m);
+		}
+		if (++h->checkOps >= CHECK_PERIOD) {
+			h->checkOps = 0;
+			sanityCheck(h);
+		}
+		break;
+	default:
+		sanityCheck(h);
+		break;
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Add a region of memory to a heap. Caller must hold the heap's lock,
+ * if the heap is in use.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       r: Region control structure, not within the region.
+ *       addr: Start address of region of memory to be managed.
+ *       size: Size of region of memory to be managed.
+ *
+ * @param[out]
+ *       None
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if region is too small
+ */
+static int
+regionInit(memHeap_t *h, region_t *r, void *addr, int size)
+{
+	region_t **rp;
+	mcb_t	*m, *fence;
+	long	avail;
+
+	/* Mark entire region, but for the fence at its end, as free. The
+	 * first block is placed so that memory given out is MEM_ALIGN
+	 * aligned.
+	 */
+	m = (mcb_t *) (ALIGN_UP((char *) addr + sizeof(mcb_t), MEM_ALIGN) -
+		       sizeof(mcb_t));
+	fence = (mcb_t *) (ALIGN_DOWN((char *) addr + size, MEM_ALIGN) -
+			   sizeof(*fence));
+	avail = (char *) fence - (char *) mcbAddr(m);
+	if (avail < (long) (MIN_FREE_BLOCK - sizeof(*m))) {
+		return (-1);
+	}
+	MCB_SET_SIZE(m, avail);
+	MCB_SET_MAGIC(m, MAGIC_FREE);
+	MCB_SET_PINUSE(m);	/* No preceding block to merge with */
+	MCB_SET_MAGIC(fence, MAGIC_FENCE);
+	MCB_SET_SIZE(fence, 0);
+	r->mcb = m;
+	r->endMem = fence;
+
+	rp = &h->regions;
+	while (*rp && ((*rp)->mcb < m)) {
+		rp = &(*rp)->next;
+	}
+	r->next = *rp;
+	*rp = r;
+	h->capacity += (char *) fence - (char *) m;
+	insertFree(h, m);
+	return 0;
+}
+
+/**
+ * @brief
+ * Set up a heap to manage a region of memory. Caller must hold the
+ * heap's lock, if the heap is in use.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addr: Start address of region of memory to be managed.
+ *       size: Size of region of memory to be managed.
+ *       mode: Free block management engine to use.
+ *
+ * @param[out]
+ *       None
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if region is too small
+ */
+static int
+heapInit(memHeap_t *h, void *addr, int size, memMode_t mode)
+{
+	int	rc;
+
+	h->regions = NULL;
+	h->capacity = 0;
+	memset(&h->cnt, 0, sizeof(h->cnt));
+	h->mode = mode;
+	h->policy = MEM_FIT_WORST;
+	memset(h->freeBins, 0, sizeof(h->freeBins));
+	memset(h->slMap, 0, sizeof(h->slMap));
+	h->flMap = 0;
+	h->check = CHECK_DEFAULT;
+	h->checkOps = 0;
+	h->debug = 0;
+	h->owned = FALSE;
+	h->remote = NULL;
+	h->largeMin = MEM_LARGE_MIN;
+	h->largeBlocks = h->largeBytes = 0;
+	rc = regionInit(h, &h->region0, addr, size);
+	heapCheck(h, h->regions ? h->regions->mcb : NULL);
+	return rc;
+}
+
+/**
+ * @brief
+ * Get the size of memory block needed for an allocation request.
+ *
+ * @param[in]
+ *       size: Number of bytes requested.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Size of memory block.
+ */
+static int
+blockSize(int size)
+{
+	/* Any memory block must be able to hold the links needed for
+	 * memory block in a free bin, and the foot of a free block.
+	 */
+	if (size < MIN_FREE_BLOCK - sizeof(mcb_t)) {
+		size = MIN_FREE_BLOCK - sizeof(mcb_t);
+	}
+	/* Block sizes, with the MCB, are kept a multiple of MEM_ALIGN, so
+	 * that all blocks stay aligned.
+	 */
+	return (((size + (int) sizeof(mcb_t) + MEM_ALIGN - 1) &
+		 ~(MEM_ALIGN - 1)) - (int) sizeof(mcb_t));
+}
+
+/**
+ * @brief
+ * Trim an in-use memory block to a given size, turning the balance into
+ * a free block if it is large enough to be one.
+ *
+ * @note
+ * The new free block is merged with the block following it, if that is
+ * free. This can only be the case when a block is shrunk by realloc.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       m: MCB of block, which must not be in a free bin.
+ *       size: Size to trim block to.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+splitBlock(memHeap_t *h, mcb_t *m, int size)
+{
+	mcb_t	*n, *next;
+	int	balance;
+
+	balance = MCB_SIZE(m) - size;
+
+	/* New free block must be at least a certain
+	 * minimum size. If not, the whole block stays allocated.
+	 */
+	if (balance <= MIN_FREE_BLOCK) {
+		return;
+	}
+
+	/* Create a new free block of smaller size */
+	next = mcbNext(h, m);
+	n = (mcb_t *) ((char *) mcbAddr(m) + size);
+	MCB_SET_MAGIC(n, MAGIC_FREE);
+	MCB_SET_SIZE(n, balance - sizeof(*m));
+	MCB_SET_PINUSE(n);
+	MCB_SET_SIZE(m, size);
+	if (next && (MCB_MAGIC(next) == MAGIC_FREE)) {
+		removeFree(h, next);
+		MCB_SET_MAGIC(next, 0);
+		MCB_SET_SIZE(n, MCB_SIZE(n) + sizeof(*next) + MCB_SIZE(next));
+	}
+	insertFree(h, n);
+	return;
+}
+
+/**
+ * @brief
+ * Allocate memory from a heap. Caller must hold the heap's lock.
+ *
+ * @note
+ * The block is chosen as per the engine and placement policy of the
+ * heap. For better performance free blocks are kept in segregated
+ * size-class bins (see findFree()).
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+static void *
+heapAlloc(memHeap_t *h, int size)
+{
+	mcb_t	*m;
+
+	size = blockSize(size);
+	m = findFree(h, size);
+	if (!m) {
+		h->cnt.failures++;
+		return NULL;
+	}
+	heapPreCheck(h, m);
+	removeFree(h, m);
+
+	/* This memory block is free and has required space
+	 * to allocate for this memory allocation request.
+	 * Mark it as in use and split off the balance as a free block.
+	 */
+	MCB_SET_MAGIC(m, MAGIC_USED);
+	splitBlock(h, m, size);
+	h->cnt.allocs++;
+	h->cnt.usedBlocks++;
+	h->cnt.usedBytes += MCB_SIZE(m);
+	heapCheck(h, m);
+	return (mcbAddr(m));
+}
+
+/**
+ * @brief
+ * Allocate aligned memory from a heap. Caller must hold the heap's lock.
+ *
+ * @note
+ * A block large enough for the worst case padding is found. The leading
+ * pad is then split off as a free block of its own, and the tail, as
+ * usual, by splitBlock(), so that no memory is lost to alignment.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory to be allocated.
+ *       align: Alignment needed, a power of 2 greater than MEM_ALIGN.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to 'align' aligned memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+static void *
+heapAllocAligned(memHeap_t *h, int size, int align)
+{
+	mcb_t	*m, *a;
+	char	*u;
+
+	size = blockSize(size);
+	if (size > INT_MAX - align - MIN_FREE_BLOCK) {
+		h->cnt.failures++;
+		return NULL;
+	}
+	m = findFree(h, size + align + MIN_FREE_BLOCK);
+	if (!m) {
+		h->cnt.failures++;
+		return NULL;
+	}
+	heapPreCheck(h, m);
+	removeFree(h, m);
+
+	u = ALIGN_UP(mcbAddr(m), align);
+	if (u != (char *) mcbAddr(m)) {
+		/* Leading pad must be large enough to be a free block. */
+		if (u - (char *) mcbAddr(m) < MIN_FREE_BLOCK) {
+			u += align;
+		}
+		a = (mcb_t *) (u - sizeof(*a));
+		MCB_SET_SIZE(a, (char *) mcbAddr(m) + MCB_SIZE(m) - u);
+		MCB_SET_SIZE(m, (char *) a - (char *) mcbAddr(m));
+		insertFree(h, m);
+		m = a;
+	}
+
+	MCB_SET_MAGIC(m, MAGIC_USED);
+	splitBlock(h, m, size);
+	h->cnt.allocs++;
+	h->cnt.usedBlocks++;
+	h->cnt.usedBytes += MCB_SIZE(m);
+	heapCheck(h, m);
+	return (mcbAddr(m));
+}
+
+/**
+ * @brief
+ * Free memory back to a heap. Caller must hold the heap's lock.
+ *
+ * @note
+ * Since the memory block is contiguous with the memory allocated,
+ * the algorithm to free is quite efficient.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addr: Start address of memory to be freed back.
+ *             The 'addr' must be same as what was returned by
+ *             memAlloc().
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+heapFree(memHeap_t *h, void *addr)
+{
+	mcb_t	*m, *prev, *next;
+
+	if (!addr) return;
+
+	/* We expect MCB to be just above the addr.
+	 * If MCB is not present it means a wrong address has been
+	 * passed for freeing.
+	 */
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (MCB_MAGIC(m) != MAGIC_USED) {
+		/* Sanity failed! */
+		return;
+	}
+	heapPreCheck(h, m);
+
+	/* Mark block as free */
+	MCB_SET_MAGIC(m, MAGIC_FREE);
+	h->cnt.frees++;
+	h->cnt.usedBlocks--;
+	h->cnt.usedBytes -= MCB_SIZE(m);
+
+	/* Merge with preceeding block, if possible */
+	if (!MCB_PINUSE(m)) {
+		prev = MCB_PREV(m);
+		removeFree(h, prev);
+		MCB_SET_MAGIC(m, 0);
+		MCB_SET_SIZE(prev, MCB_SIZE(prev) + MCB_SIZE(m) + sizeof(*m));
+		m = prev;
+	}
+
+	/* Merge with succeeding block, if possible */
+	next = mcbNext(h, m);
+	if (next && (MCB_MAGIC(next) == MAGIC_FREE)) {
+		removeFree(h, next);
+		MCB_SET_MAGIC(next, 0);
+		MCB_SET_SIZE(m, MCB_SIZE(m) + sizeof(*m) + MCB_SIZE(next));
+	}
+
+	/* Size of 'm' is final only now, so it goes into its bin once. */
+	insertFree(h, m);
+	heapCheck(h, m);
+	return;
+}
+
+/**
+ * @brief
+ * Allocate a number of memory blocks of the same size from a heap.
+ * Caller must hold the heap's lock.
+ *
+ * @note
+ * Blocks are carved one after another out of a free block, which is
+ * put back into a free bin only once, after the last block is carved
+ * from it. Another free block is found only when one runs out.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory in each block.
+ *       n: Number of blocks.
+ *
+ * @param[out]
+ *       out: Pointers to memory allocated.
+ *
+ * @return
+ *       - Number of blocks allocated, less than 'n' if the heap runs
+ *         out of memory.
+ */
+static int
+heapAllocBatch(memHeap_t *h, int size, int n, void **out)
+{
+	mcb_t	*m, *c;
+	int	got;
+
+	size = blockSize(size);
+	m = NULL;
+	got = 0;
+	while (got < n) {
+		m = findFree(h, size);
+		if (!m) {
+			break;
+		}
+		heapPreCheck(h, m);
+		removeFree(h, m);
+		MCB_SET_MAGIC(m, MAGIC_USED);
+		/* Carve while 'm' can hold this and one more block. */
+		while ((got < n - 1) &&
+		       (MCB_SIZE(m) >= 2 * size + (int) sizeof(*m))) {
+			c = (mcb_t *) ((char *) mcbAddr(m) + size);
+			MCB_SET_MAGIC(c, MAGIC_USED);
+			MCB_SET_SIZE(c, MCB_SIZE(m) - size - sizeof(*c));
+			MCB_SET_PINUSE(c);
+			MCB_SET_SIZE(m, size);
+			out[got++] = mcbAddr(m);
+			h->cnt.usedBytes += size;
+			m = c;
+		}
+		splitBlock(h, m, size);
+		out[got++] = mcbAddr(m);
+		h->cnt.usedBytes += MCB_SIZE(m);
+	}
+	h->cnt.allocs += got;
+	h->cnt.usedBlocks += got;
+	if (got < n) {
+		h->cnt.failures++;
+	}
+	heapCheck(h, m);
+	return got;
+}
+
+/**
+ * @brief
+ * Free a number of memory blocks back to a heap. Caller must hold the
+ * heap's lock.
+ *
+ * @note
+ * All the blocks are first marked MAGIC_BATCH, and given a foot as if
+ * they were free, so that the start of a run can be found from any
+ * block in it. Then each run of contiguous blocks that are free or
+ * being freed is merged into one block and inserted into a free bin
+ * once, instead of once per block.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addrs: Start addresses of memory to be freed back. NULL
+ *              entries are ignored.
+ *       n: Number of entries in 'addrs'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+heapFreeBatch(memHeap_t *h, void **addrs, int n)
+{
+	mcb_t	*m, *next, *nnext, *last;
+	int	i;
+
+	/* Blocks are checked before any is marked, while the heap is
+	 * consistent.
+	 */
+	if (h->check != MEM_CHECK_OFF) {
+		for (i = 0; i < n; i++) {
+			if (!addrs[i]) continue;
+			m = (mcb_t *) (addrs[i] - sizeof(*m));
+			if (MCB_MAGIC(m) == MAGIC_USED) {
+				heapPreCheck(h, m);
+			}
+		}
+	}
+
+	last = NULL;
+	for (i = 0; i < n; i++) {
+		if (!addrs[i]) continue;
+		m = (mcb_t *) (addrs[i] - sizeof(*m));
+		if (MCB_MAGIC(m) == MAGIC_USED) {
+			MCB_SET_MAGIC(m, MAGIC_BATCH);
+			MCB_FOOT(MCB_AFTER(m)) = MCB_SIZE(m);
+			HEAP_CLEAR_PINUSE(h, MCB_AFTER(m));
+			h->cnt.frees++;
+			h->cnt.usedBlocks--;
+			h->cnt.usedBytes -= MCB_SIZE(m);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!addrs[i]) continue;
+		m = (mcb_t *) (addrs[i] - sizeof(*m));
+		if (MCB_MAGIC(m) != MAGIC_BATCH) {
+			/* Bad address, or already merged. */
+			continue;
+		}
+		/* Find start of the run. */
+		while (!MCB_PINUSE(m)) {
+			m = MCB_PREV(m);
+		}
+		if (MCB_MAGIC(m) == MAGIC_FREE) {
+			removeFree(h, m);
+		}
+		MCB_SET_MAGIC(m, MAGIC_FREE);
+		/* Merge rest of the run into it. */
+		next = mcbNext(h, m);
+		while (next && ((MCB_MAGIC(next) == MAGIC_BATCH) ||
+				(MCB_MAGIC(next) == MAGIC_FREE))) {
+			if (MCB_MAGIC(next) == MAGIC_FREE) {
+				removeFree(h, next);
+			}
+			nnext = mcbNext(h, next);
+			MCB_SET_MAGIC(next, 0);
+			MCB_SET_SIZE(m, MCB_SIZE(m) + sizeof(*next) +
+				     MCB_SIZE(next));
+			next = nnext;
+		}
+		insertFree(h, m);
+		last = m;
+	}
+	heapCheck(h, last);
+	return;
+}
+
+/**
+ * @brief
+ * Resize an in-use memory block in place. Caller must hold the heap's
+ * lock.
+ *
+ * @note
+ * A block is shrunk by splitting off its tail as a free block. It is
+ * grown by absorbing the free block that follows it, if that is large
+ * enough, and then splitting off whatever is not needed.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       m: MCB of block to be resized.
+ *       size: Number of bytes needed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE : Block was resized
+ *       - FALSE : Block cannot be grown in place
+ */
+static int
+heapRealloc(memHeap_t *h, mcb_t *m, int size)
+{
+	mcb_t	*next;
+	int	old = MCB_SIZE(m);
+
+	heapPreCheck(h, m);
+	size = blockSize(size);
+	if (size > MCB_SIZE(m)) {
+		next = mcbNext(h, m);
+		if (!next || (MCB_MAGIC(next) != MAGIC_FREE) ||
+		    (MCB_SIZE(m) + sizeof(*next) + MCB_SIZE(next) < size)) {
+			return FALSE;
+		}
+		removeFree(h, next);
+		MCB_SET_MAGIC(next, 0);
+		MCB_SET_SIZE(m, MCB_SIZE(m) + sizeof(*next) + MCB_SIZE(next));
+	}
+	splitBlock(h, m, size);
+	h->cnt.usedBytes += MCB_SIZE(m) - old;
+	heapCheck(h, m);
+	return TRUE;
+}
+
+/**
+ * @brief
+ * Check if an allocation request is to be served by a span.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes requested.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE : Request is large
+ *       - FALSE : Request is to be served from the regions of the heap
+ */
+static int
+isLarge(memHeap_t *h, int size)
+{
+	return (h->largeMin && (size >= h->largeMin));
+}
+
+/**
+ * @brief
+ * Get the length of mapping needed for a span.
+ *
+ * @param[in]
+ *       size: Number of bytes requested.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Length of mapping, a multiple of the page size.
+ */
+static size_t
+spanLen(int size)
+{
+	size_t	page = sysconf(_SC_PAGESIZE);
+
+	return ((sizeof(span_t) + (size_t) size + page - 1) & ~(page - 1));
+}
+
+/**
+ * @brief
+ * Allocate a large block as a mapping of its own. The heap's lock is
+ * not needed.
+ *
+ * @note
+ * A guarded span is mapped with a PROT_NONE page after it, and its
+ * memory is placed to end at that page, so that an overrun faults at
+ * once. Only the up to MEM_ALIGN - 1 bytes of padding that keep the
+ * memory aligned go unguarded. The header of any span is in the first
+ * page of its mapping.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory to be allocated.
+ *       guard: TRUE to end the block at a guard page.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+static void *
+spanAlloc(memHeap_t *h, int size, int guard)
+{
+	size_t	page = sysconf(_SC_PAGESIZE);
+	span_t	*s;
+	char	*base;
+	size_t	len;
+
+	len = spanLen(size) + (guard ? page : 0);
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	if (!guard) {
+		s = (span_t *) base;
+		s->len = len;
+	} else if (mprotect(base + len - page, page, PROT_NONE) == 0) {
+		s = (span_t *) (base + len - page -
+				ALIGN_UP(size, MEM_ALIGN)) - 1;
+		s->len = len | SPAN_GUARD;
+	} else {
+		munmap(base, len);
+		return NULL;
+	}
+	s->magic = MAGIC_LARGE;
+	s->size = size;
+	__atomic_add_fetch(&h->largeBlocks, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->largeBytes, len, __ATOMIC_RELAXED);
+	return (s + 1);
+}
+
+/**
+ * @brief
+ * Unmap a large block. The heap's lock is not needed.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       s: Header of large block.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+spanFree(memHeap_t *h, span_t *s)
+{
+	size_t	page = sysconf(_SC_PAGESIZE);
+	size_t	len = s->len & ~(size_t) SPAN_GUARD;
+
+	__atomic_sub_fetch(&h->largeBlocks, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&h->largeBytes, len, __ATOMIC_RELAXED);
+	s->magic = 0;
+	munmap(ALIGN_DOWN(s, page), len);
+	return;
+}
+
+/**
+ * @brief
+ * Resize a large block. The heap's lock must not be held.
+ *
+ * @note
+ * A block that stays large is remapped, so its contents are moved, if
+ * at all, by the kernel rather than copied. A block that is no longer
+ * large, or that is guarded, is moved with a copy.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       s: Header of large block.
+ *       size: Number of bytes needed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On success, pointer to start of memory area which has at
+ *         least 'size' bytes of memory.
+ *       - On failure, NULL is returned and the block is left untouched.
+ */
+static void *
+spanRealloc(memHeap_t *h, span_t *s, int size)
+{
+	span_t	*ns;
+	void	*naddr;
+	size_t	len;
+
+	if (!isLarge(h, size) || (s->len & SPAN_GUARD)) {
+		naddr = memHeapAlloc(h, size);
+		if (naddr) {
+			memcpy(naddr, s + 1, (size < s->size) ? size : s->size);
+			spanFree(h, s);
+		}
+		return naddr;
+	}
+
+	len = spanLen(size);
+	if (len != s->len) {
+		ns = mremap(s, s->len, len, MREMAP_MAYMOVE);
+		if (ns == MAP_FAILED) {
+			return NULL;
+		}
+		if (len > ns->len) {
+			__atomic_add_fetch(&h->largeBytes, len - ns->len,
+					   __ATOMIC_RELAXED);
+		} else {
+			__atomic_sub_fetch(&h->largeBytes, ns->len - len,
+					   __ATOMIC_RELAXED);
+		}
+		ns->len = len;
+		s = ns;
+	}
+	s->size = size;
+	return (s + 1);
+}
+
+/**
+ * @brief
+ * Free the blocks in the remote free queue of a heap. Caller must hold
+ * the heap's lock.
+ *
+ * @note
+ * The whole queue is taken with one atomic exchange, and its blocks are
+ * merged back REMOTE_BATCH at a time by heapFreeBatch().
+ *
+ * @param[in]
+ *       h: Heap.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+heapDrain(memHeap_t *h)
+{
+	void	*addrs[REMOTE_BATCH];
+	mcb_t	*m, *next;
+	int	n;
+
+	if (__atomic_load_n(&h->remote, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+	m = __atomic_exchange_n(&h->remote, NULL, __ATOMIC_ACQUIRE);
+	n = 0;
+	while (m) {
+		next = ((freelist_links_t *) mcbAddr(m))->next;
+		MCB_SET_MAGIC(m, MAGIC_USED);
+		addrs[n++] = mcbAddr(m);
+		if (n == REMOTE_BATCH) {
+			heapFreeBatch(h, addrs, n);
+			n = 0;
+		}
+		m = next;
+	}
+	if (n) {
+		heapFreeBatch(h, addrs, n);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Check if the calling thread must free to a heap through its remote
+ * free queue.
+ *
+ * @param[in]
+ *       h: Heap.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE : Heap has an owner, other than the calling thread
+ *       - FALSE : Otherwise
+ */
+static int
+heapForeign(memHeap_t *h)
+{
+	return (__atomic_load_n(&h->owned, __ATOMIC_ACQUIRE) &&
+		!pthread_equal(h->owner, pthread_self()));
+}
+
+/**
+ * @brief
+ * Push memory blocks to the remote free queue of a heap, without taking
+ * its lock.
+ *
+ * @note
+ * The blocks are chained together first, so that the whole chain is
+ * pushed with a single compare-and-swap (in the absence of contention).
+ * A block is claimed by switching its magic# from MAGIC_USED to
+ * MAGIC_REMOTE, so a block freed twice is pushed only once.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addrs: Start addresses of memory to be freed back. NULL
+ *              entries are ignored.
+ *       n: Number of entries in 'addrs'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+remoteFree(memHeap_t *h, void **addrs, int n)
+{
+	mcb_t	*m, *first, *last, *old;
+	uint32_t magic;
+	int	i;
+
+	first = last = NULL;
+	for (i = 0; i < n; i++) {
+		if (!addrs[i]) continue;
+		m = (mcb_t *) (addrs[i] - sizeof(*m));
+#ifndef MEM_COMPACT_HDR
+		magic = MAGIC_USED;
+		if (!__atomic_compare_exchange_n(&m->magic, &magic,
+						 MAGIC_REMOTE, FALSE,
+						 __ATOMIC_RELAXED,
+						 __ATOMIC_RELAXED)) {
+			/* Sanity failed! */
+			continue;
+		}
+#else
+		/* The state shares its word with MCB_PINUSE_BIT, which the
+		 * owner may change meanwhile, so the whole word is swapped.
+		 */
+		magic = __atomic_load_n(&m->head, __ATOMIC_RELAXED);
+		do {
+			if ((magic & MCB_MAGIC_MASK) != MAGIC_USED) {
+				break;
+			}
+		} while (!__atomic_compare_exchange_n(&m->head, &magic,
+				(magic & ~MCB_MAGIC_MASK) | MAGIC_REMOTE,
+				TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		if ((magic & MCB_MAGIC_MASK) != MAGIC_USED) {
+			/* Sanity failed! */
+			continue;
+		}
+#endif /* MEM_COMPACT_HDR */
+		((freelist_links_t *) mcbAddr(m))->next = first;
+		first = m;
+		if (!last) {
+			last = m;
+		}
+	}
+	if (!first) {
+		return;
+	}
+
+	old = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+	do {
+		((freelist_links_t *) mcbAddr(last))->next = old;
+	} while (!__atomic_compare_exchange_n(&h->remote, &old, first, TRUE,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+	return;
+}
+
+/**
+ * @brief
+ * Get the number of bytes to allocate before the next sample of the
+ * calling thread, drawn from an exponential distribution.
+ *
+ * @note
+ * The natural log needed is worked out from the bit length of a 26-bit
+ * uniform random number and a quadratic fit of log2() over the rest, so
+ * that no math library is needed. The fit is good to 1%.
+ *
+ * @param[in]
+ *       rate: Mean of the distribution.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Number of bytes, at least 1.
+ */
+static long
+profInterval(long rate)
+{
+	uint64_t	x = tcache.profSeed;
+	uint32_t	u;
+	double	f, l;
+	int	b;
+
+	if (x == 0) {
+		x = (uintptr_t) &tcache | 1;
+	}
+	x ^= x >> 12;		/* xorshift64* */
+	x ^= x << 25;
+	x ^= x >> 27;
+	tcache.profSeed = x;
+	u = ((x * 0x2545F4914F6CDD1DULL) >> 38) + 1;	/* 1 to 2^26 */
+
+	/* -ln(u / 2^26) = (26 - log2(u)) * ln(2) */
+	b = 31 - __builtin_clz(u);
+	f = (double) (u - (1U << b)) / (1U << b);
+	l = b + f * (1.3465 - 0.3465 * f);
+	return (long) ((26 - l) * 0.693147 * rate) + 1;
+}
+
+/**
+ * @brief
+ * Take a sample being freed off the list of live samples.
+ *
+ * @param[in]
+ *       p: Header of sampled block.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+profUnlink(prof_t *p)
+{
+	pthread_mutex_lock(&profLock);
+	if (p->next) {
+		p->next->prev = p->prev;
+	}
+	if (p->prev) {
+		p->prev->next = p->next;
+	} else {
+		profLive = p->next;
+	}
+	pthread_mutex_unlock(&profLock);
+	p->magic = 0;
+	return;
+}
+
+/* Copy of a sample, as taken by memProfDump() */
+typedef struct profRec_ {
+	void	*stack[PROF_DEPTH];
+	long	weight;
+} profRec_t;
+
+/**
+ * @brief
+ * Order copies of samples by their stacks, for qsort().
+ */
+static int
+profRecCmp(const void *a, const void *b)
+{
+	return memcmp(((const profRec_t *) a)->stack,
+		      ((const profRec_t *) b)->stack,
+		      sizeof(((profRec_t *) 0)->stack));
+}
+
+/**
+ * @brief
+ * Write the stack of a sample as the frames of a folded stack,
+ * outermost first and separated by ';'.
+ *
+ * @note
+ * A frame is named by its function when dladdr() knows it, which for
+ * functions of the program needs it to be linked with -rdynamic, and as
+ * object+offset otherwise, which addr2line(1) can resolve.
+ *
+ * @param[in]
+ *       fd: File descriptor to write to.
+ *       stack: Stack of sample, PROF_DEPTH entries.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+profWriteStack(int fd, void **stack)
+{
+	Dl_info	info;
+	const char	*obj;
+	int	i, first = TRUE;
+
+	for (i = PROF_DEPTH - 1; i >= 0; i--) {
+		if (!stack[i]) continue;
+		if (!first) {
+			dprintf(fd, ";");
+		}
+		first = FALSE;
+		if (!dladdr(stack[i], &info) || !info.dli_fname) {
+			dprintf(fd, "%p", stack[i]);
+		} else if (info.dli_sname) {
+			dprintf(fd, "%s", info.dli_sname);
+		} else {
+			obj = strrchr(info.dli_fname, '/');
+			dprintf(fd, "%s+%#lx", obj ? obj + 1 : info.dli_fname,
+				(unsigned long) ((char *) stack[i] -
+						 (char *) info.dli_fbase));
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Allocate memory from a heap, as a span if it is large, or else from
+ * its regions.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+static void *
+heapAllocAny(memHeap_t *h, int size)
+{
+	void	*addr;
+
+	if (isLarge(h, size)) {
+		addr = spanAlloc(h, size, FALSE);
+		if (addr) {
+			return addr;
+		}
+	}
+	pthread_mutex_lock(&h->lock);
+	heapDrain(h);
+	addr = heapAlloc(h, size);
+	pthread_mutex_unlock(&h->lock);
+	return addr;
+}
+
+/**
+ * @brief
+ * Free memory back to a heap, be it a span or a block of a region,
+ * sampled or not.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addr: Start address of memory to be freed back.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+heapFreeAny(memHeap_t *h, void *addr)
+{
+	mcb_t	*m;
+
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (MCB_MAGIC(m) == MAGIC_PROF) {
+		profUnlink((prof_t *) addr - 1);
+		addr = (prof_t *) addr - 1;
+		m = (mcb_t *) (addr - sizeof(*m));
+	}
+	if (MCB_MAGIC(m) == MAGIC_LARGE) {
+		spanFree(h, (span_t *) addr - 1);
+		return;
+	}
+	if (heapForeign(h)) {
+		remoteFree(h, &addr, 1);
+		return;
+	}
+	pthread_mutex_lock(&h->lock);
+	heapFree(h, addr);
+	pthread_mutex_unlock(&h->lock);
+	return;
+}
+
+/**
+ * @brief
+ * Allocate memory from the default heap as a sample of the heap
+ * profiler, once the calling thread has allocated enough bytes since
+ * its last sample.
+ *
+ * @note
+ * Not inlined, so that its frame and that of memAlloc() are the two
+ * innermost ones of the stack captured.
+ *
+ * @param[in]
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - NULL, if the allocation is not to be sampled after all or
+ *         fails. It is to be made as usual then.
+ */
+static void * __attribute__ ((noinline))
+profAlloc(int size)
+{
+	long	rate = profRate;
+	void	*frames[PROF_DEPTH + 2];
+	prof_t	*p;
+	int	i, n, samples;
+
+	if (!rate) {
+		return NULL;
+	}
+	if (tcache.profGen != profGen) {
+		/* First allocation of the thread since the rate was set */
+		tcache.profGen = profGen;
+		tcache.profLeft = profInterval(rate);
+		return NULL;
+	}
+	/* An allocation spanning several intervals stands for as many
+	 * samples.
+	 */
+	for (samples = 0; tcache.profLeft < 0; samples++) {
+		tcache.profLeft += profInterval(rate);
+	}
+
+	if ((size < 0) || (size > INT_MAX - sizeof(*p))) {
+		return NULL;
+	}
+	p = heapAllocAny(&defaultHeap, sizeof(*p) + size);
+	if (!p) {
+		return NULL;
+	}
+	n = backtrace(frames, PROF_DEPTH + 2);
+	for (i = 0; i < PROF_DEPTH; i++) {
+		p->stack[i] = (i + 2 < n) ? frames[i + 2] : NULL;
+	}
+	p->weight = samples * rate;
+	p->magic = MAGIC_PROF;
+	p->size = size;
+
+	pthread_mutex_lock(&profLock);
+	p->prev = NULL;
+	p->next = profLive;
+	if (profLive) {
+		profLive->prev = p;
+	}
+	profLive = p;
+	pthread_mutex_unlock(&profLock);
+	return (p + 1);
+}
+
+/**
+ * @brief
+ * Report misuse of memory caught by a debug heap, and abort.
+ *
+ * @param[in]
+ *       what: Kind of misuse.
+ *       addr: Start address of memory.
+ *       d: Header of debug block, or NULL if 'addr' is not one.
+ *       site: Return address of the call that caught the misuse.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Does not return.
+ */
+static void
+debugReport(const char *what, void *addr, dbg_t *d, void *site)
+{
+	if (d) {
+		fprintf(stderr, "mem: %s of %p (%d bytes, allocated from %p)"
+			", caught in call from %p\n", what, addr, d->size,
+			d->site, site);
+	} else {
+		fprintf(stderr, "mem: %s of %p, caught in call from %p\n",
+			what, addr, site);
+	}
+	CHECK_FAIL();
+}
+
+/**
+ * @brief
+ * Check the canaries of a debug block.
+ *
+ * @param[in]
+ *       addr: Start address of memory of debug block.
+ *       site: Return address of the call doing the check.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None: on success
+ *       - Does not return: on failure
+ */
+static void
+debugCheck(void *addr, void *site)
+{
+	dbg_t	*d = (dbg_t *) addr - 1;
+	uint8_t	*p;
+	int	i;
+
+	for (i = 0; i < sizeof(d->front); i++) {
+		if (d->front[i] != CANARY) break;
+	}
+	if ((i < sizeof(d->front)) || (d->nsize != ~d->size)) {
+		debugReport("underrun", addr, d, site);
+	}
+	p = (uint8_t *) addr + d->size;
+	for (i = 0; i < REDZONE; i++) {
+		if (p[i] != CANARY) {
+			debugReport("overrun", addr, d, site);
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Allocate memory from a heap with debug flags set.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       size: Number of bytes of memory to be allocated.
+ *       site: Return address of allocating call.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+static void *
+debugAlloc(memHeap_t *h, int size, void *site)
+{
+	dbg_t	*d;
+	void	*addr;
+
+	if ((h->debug & MEM_DEBUG_GUARD) && isLarge(h, size)) {
+		addr = spanAlloc(h, size, TRUE);
+		if (addr) {
+			return addr;
+		}
+	}
+	if (!(h->debug & MEM_DEBUG_REDZONE)) {
+		return heapAllocAny(h, size);
+	}
+
+	if ((size < 0) || (size > INT_MAX - sizeof(*d) - REDZONE)) {
+		return NULL;
+	}
+	d = heapAllocAny(h, sizeof(*d) + size + REDZONE);
+	if (!d) {
+		return NULL;
+	}
+	d->site = site;
+	d->size = size;
+	memset(d->front, CANARY, sizeof(d->front));
+	d->magic = MAGIC_DEBUG;
+	d->nsize = ~size;
+	memset((char *) (d + 1) + size, CANARY, REDZONE);
+	return (d + 1);
+}
+
+/**
+ * @brief
+ * Free memory back to a heap with debug flags set, or a debug block to
+ * any heap.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addr: Start address of memory to be freed back.
+ *       site: Return address of freeing call.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+debugFree(memHeap_t *h, void *addr, void *site)
+{
+	mcb_t	*m;
+	dbg_t	*d;
+
+	m = (mcb_t *) (addr - sizeof(*m));
+	switch (MCB_MAGIC(m)) {
+	case MAGIC_DEBUG:
+		debugCheck(addr, site);
+		d = (dbg_t *) addr - 1;
+		d->magic = MAGIC_FREE;	/* So that a second free is caught */
+		heapFreeAny(h, d);
+		break;
+	case MAGIC_USED:
+	case MAGIC_LARGE:
+	case MAGIC_PROF:
+		heapFreeAny(h, addr);
+		break;
+	case MAGIC_FREE:
+		debugReport("double free", addr, NULL, site);
+		break;
+	default:
+		debugReport("bad free", addr, NULL, site);
+		break;
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Resize memory of a heap with debug flags set, or a debug or sampled
+ * block of any heap. The contents are always moved, so that canaries and
+ * samples are laid out afresh.
+ *
+ * @param[in]
+ *       h: Heap.
+ *       addr: Start address of memory.
+ *       size: Number of bytes of memory needed.
+ *       site: Return address of resizing call.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On success, pointer to start of memory area which has at
+ *         least 'size' bytes of memory.
+ *       - On failure, NULL is returned and 'addr' is left untouched.
+ */
+static void *
+debugRealloc(memHeap_t *h, void *addr, int size, void *site)
+{
+	mcb_t	*m;
+	void	*naddr;
+	int	osize;
+
+	m = (mcb_t *) (addr - sizeof(*m));
+	switch (MCB_MAGIC(m)) {
+	case MAGIC_DEBUG:
+		debugCheck(addr, site);
+		osize = ((dbg_t *) addr - 1)->size;
+		break;
+	case MAGIC_LARGE:
+		osize = ((span_t *) addr - 1)->size;
+		break;
+	case MAGIC_PROF:
+		osize = ((prof_t *) addr - 1)->size;
+		break;
+	case MAGIC_USED:
+		osize = MCB_SIZE(m);
+		break;
+	default:
+		debugReport("bad realloc", addr, NULL, site);
+		return NULL;
+	}
+
+	naddr = h->debug ? debugAlloc(h, size, site) : heapAllocAny(h, size);
+	if (naddr) {
+		memcpy(naddr, addr, (size < osize) ? size : osize);
+		debugFree(h, addr, site);
+	}
+	return naddr;
+}
+
+/**
+ * @brief
+ * API to create a heap to manage a region of memory.
+ *
+ * @note
+ * The heap control structure is kept at the (cache line aligned) start
+ * of the region, and the rest of the region is available for allocation.
+ * Each heap has its own lock, so distinct heaps can be used concurrently.
+ *
+ * @param[in]
+ *       addr: Start address of region of memory to be managed.
+ *       size: Size of region of memory to be managed.
+ *       mode: Free block management engine to use.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Handle of new heap
+ *       - Failure : NULL, if region is too small
+ */
+memHeap_t *
+memHeapCreate(void *addr, int size, memMode_t mode)
+{
+	memHeap_t *h;
+	char	*start;
+
+	h = (memHeap_t *) (((uintptr_t) addr + __alignof__(memHeap_t) - 1) &
+			   ~((uintptr_t) __alignof__(memHeap_t) - 1));
+	start = (char *) (h + 1);
+	if (heapInit(h, start, size - (start - (char *) addr), mode) < 0) {
+		return NULL;
+	}
+	pthread_mutex_init(&h->lock, NULL);
+	return h;
+}
+
+/**
+ * @brief
+ * API to add a region of memory to a heap, so that the heap can grow.
+ *
+ * @note
+ * The region control structure is kept at the start of the region. The
+ * blocks of a region are never merged with those of another region, so
+ * regions need not be contiguous.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       addr: Start address of region of memory to be added.
+ *       size: Size of region of memory to be added.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if region is too small
+ */
+int
+memHeapAddRegion(memHeap_t *heap, void *addr, int size)
+{
+	region_t *r;
+	char	*start;
+	int	rc;
+
+	r = (region_t *) ALIGN_UP(addr, __alignof__(region_t));
+	start = (char *) (r + 1);
+	if (start > (char *) addr + size) {
+		return (-1);
+	}
+	pthread_mutex_lock(&heap->lock);
+	rc = regionInit(heap, r, start, size - (start - (char *) addr));
+	if (rc == 0) {
+		heapCheck(heap, r->mcb);
+	}
+	pthread_mutex_unlock(&heap->lock);
+	return rc;
+}
+
+/**
+ * @brief
+ * API to allocate memory from a heap.
+ *
+ * @param[in]
+ *       heap: Heap to allocate from.
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+void *
+memHeapAlloc(memHeap_t *heap, int size)
+{
+	if (heap->debug) {
+		return debugAlloc(heap, size, __builtin_return_address(0));
+	}
+	return heapAllocAny(heap, size);
+}
+
+/**
+ * @brief
+ * API to allocate aligned memory from a heap.
+ *
+ * @param[in]
+ *       heap: Heap to allocate from.
+ *       size: Number of bytes of memory to be allocated.
+ *       align: Alignment needed. Must be a power of 2.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to 'align' aligned memory
+ *         area which has at least 'size' bytes of memory. The memory
+ *         is freed with memHeapFree().
+ *       - On failure, NULL is returned.
+ */
+void *
+memHeapAllocAligned(memHeap_t *heap, int size, int align)
+{
+	void	*addr;
+
+	if ((align <= 0) || (align & (align - 1))) {
+		return NULL;
+	}
+	if (align <= MEM_ALIGN) {
+		return memHeapAlloc(heap, size);
+	}
+	pthread_mutex_lock(&heap->lock);
+	heapDrain(heap);
+	addr = heapAllocAligned(heap, size, align);
+	pthread_mutex_unlock(&heap->lock);
+	return addr;
+}
+
+/**
+ * @brief
+ * API to free memory back to a heap.
+ *
+ * @note
+ * A thread other than the owner of the heap (see memHeapSetOwner())
+ * does not take the heap's lock. It pushes the memory to the heap's
+ * remote free queue, from which the owner merges it back into the heap
+ * on its next allocation.
+ *
+ * @param[in]
+ *       heap: Heap the memory was allocated from.
+ *       addr: Start address of memory to be freed back.
+ *             The 'addr' must be same as what was returned by
+ *             memHeapAlloc().
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapFree(memHeap_t *heap, void *addr)
+{
+	mcb_t	*m;
+
+	if (!addr) return;
+
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (heap->debug || (MCB_MAGIC(m) == MAGIC_DEBUG)) {
+		debugFree(heap, addr, __builtin_return_address(0));
+		return;
+	}
+	heapFreeAny(heap, addr);
+	return;
+}
+
+/**
+ * @brief
+ * API to allocate a number of memory blocks of the same size from a
+ * heap in one go.
+ *
+ * @param[in]
+ *       heap: Heap to allocate from.
+ *       size: Number of bytes of memory in each block.
+ *       n: Number of blocks.
+ *
+ * @param[out]
+ *       out: Pointers to memory allocated.
+ *
+ * @return
+ *       - Number of blocks allocated. It is less than 'n' if the heap
+ *         runs out of memory.
+ */
+int
+memHeapAllocBatch(memHeap_t *heap, int size, int n, void **out)
+{
+	int	got;
+
+	pthread_mutex_lock(&heap->lock);
+	heapDrain(heap);
+	got = heapAllocBatch(heap, size, n, out);
+	pthread_mutex_unlock(&heap->lock);
+	return got;
+}
+
+/**
+ * @brief
+ * Free a number of plain memory blocks back to a heap, from the remote
+ * free queue if the heap is owned by another thread.
+ *
+ * @param[in]
+ *       heap: Heap the memory was allocated from.
+ *       addrs: Start addresses of memory to be freed back. NULL
+ *              entries are ignored.
+ *       n: Number of entries in 'addrs'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+batchFree(memHeap_t *heap, void **addrs, int n)
+{
+	if (heapForeign(heap)) {
+		remoteFree(heap, addrs, n);
+		return;
+	}
+	pthread_mutex_lock(&heap->lock);
+	heapFreeBatch(heap, addrs, n);
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * Check if a block is to be freed on its own rather than in a batch:
+ * a debug block, a span or a profiled block.
+ *
+ * @param[in]
+ *       heap: Heap the memory was allocated from.
+ *       m: MCB of block.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE if it is, FALSE otherwise.
+ */
+static int
+batchSingle(memHeap_t *heap, mcb_t *m)
+{
+	return (heap->debug || (MCB_MAGIC(m) == MAGIC_DEBUG) ||
+		(MCB_MAGIC(m) == MAGIC_LARGE) || (MCB_MAGIC(m) == MAGIC_PROF));
+}
+
+/**
+ * @brief
+ * API to free a number of memory blocks back to a heap in one go.
+ *
+ * @note
+ * A thread other than the owner of the heap pushes all the blocks to
+ * the heap's remote free queue at once (see memHeapFree()). Debug
+ * blocks, spans and profiled blocks are freed one by one; if there are
+ * any, the other blocks are gathered FREE_BATCH at a time, as 'addrs' is
+ * left as it is.
+ *
+ * @param[in]
+ *       heap: Heap the memory was allocated from.
+ *       addrs: Start addresses of memory to be freed back. NULL
+ *              entries are ignored.
+ *       n: Number of entries in 'addrs'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapFreeBatch(memHeap_t *heap, void **addrs, int n)
+{
+	void	*rest[FREE_BATCH];
+	mcb_t	*m;
+	int	i, k;
+
+	for (i = 0; i < n; i++) {
+		if (addrs[i] &&
+		    batchSingle(heap, (mcb_t *) (addrs[i] - sizeof(mcb_t)))) {
+			break;
+		}
+	}
+	if (i == n) {
+		batchFree(heap, addrs, n);
+		return;
+	}
+
+	k = 0;
+	for (i = 0; i < n; i++) {
+		if (!addrs[i]) continue;
+		m = (mcb_t *) (addrs[i] - sizeof(*m));
+		if (heap->debug || (MCB_MAGIC(m) == MAGIC_DEBUG)) {
+			debugFree(heap, addrs[i], __builtin_return_address(0));
+		} else if ((MCB_MAGIC(m) == MAGIC_LARGE) ||
+			   (MCB_MAGIC(m) == MAGIC_PROF)) {
+			heapFreeAny(heap, addrs[i]);
+		} else {
+			rest[k++] = addrs[i];
+			if (k == FREE_BATCH) {
+				batchFree(heap, rest, k);
+				k = 0;
+			}
+		}
+	}
+	if (k) {
+		batchFree(heap, rest, k);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * API to change the size of memory allocated from a heap.
+ *
+ * @note
+ * The memory is resized in place when it is being shrunk, or when it
+ * is followed by a large enough free block. Only otherwise are the
+ * contents moved to a new memory area.
+ *
+ * @param[in]
+ *       heap: Heap the memory was allocated from.
+ *       addr: Start address of memory, as returned by memHeapAlloc(),
+ *             or NULL to allocate new memory.
+ *       size: Number of bytes of memory needed. If 0, the memory
+ *             is freed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On success, pointer to start of memory area which has at
+ *         least 'size' bytes of memory, with the contents of the old
+ *         area up to the lesser of the two sizes.
+ *       - On failure, NULL is returned and 'addr' is left untouched.
+ */
+void *
+memHeapRealloc(memHeap_t *heap, void *addr, int size)
+{
+	mcb_t	*m;
+	void	*naddr;
+
+	if (!addr) {
+		return memHeapAlloc(heap, size);
+	}
+	if (size <= 0) {
+		memHeapFree(heap, addr);
+		return NULL;
+	}
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (heap->debug || (MCB_MAGIC(m) == MAGIC_DEBUG) ||
+	    (MCB_MAGIC(m) == MAGIC_PROF)) {
+		return debugRealloc(heap, addr, size,
+				    __builtin_return_address(0));
+	}
+	if (MCB_MAGIC(m) == MAGIC_LARGE) {
+		return spanRealloc(heap, (span_t *) addr - 1, size);
+	}
+
+	pthread_mutex_lock(&heap->lock);
+	heapDrain(heap);
+	if (MCB_MAGIC(m) != MAGIC_USED) {
+		naddr = NULL;
+	} else if (heapRealloc(heap, m, size)) {
+		naddr = addr;
+	} else {
+		naddr = isLarge(heap, size) ?
+			spanAlloc(heap, size, FALSE) : NULL;
+		if (!naddr) {
+			naddr = heapAlloc(heap, size);
+		}
+		if (naddr) {
+			memcpy(naddr, addr, MCB_SIZE(m));
+			heapFree(heap, addr);
+		}
+	}
+	pthread_mutex_unlock(&heap->lock);
+	return naddr;
+}
+
+/**
+ * @brief
+ * API to set the placement policy of a heap.
+ *
+ * @note
+ * The policy applies to MEM_MODE_BINS heaps. MEM_MODE_TLSF always does
+ * its own O(1) good-fit. A heap starts out with MEM_FIT_WORST.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       policy: Placement policy for subsequent allocations.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapSetPolicy(memHeap_t *heap, memPolicy_t policy)
+{
+	pthread_mutex_lock(&heap->lock);
+	heap->policy = policy;
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to set how much verification of a heap is done by each operation.
+ *
+ * @note
+ * MEM_CHECK_LOCAL checks, in O(1), the block an operation starts with and
+ * its neighbours, before any of them is unlinked or merged, and the block
+ * the operation ends with. MEM_CHECK_SAMPLED adds a walk of the whole
+ * heap every CHECK_PERIOD operations, and MEM_CHECK_FULL walks it on every
+ * operation. A heap that fails a check is corrupt, and the program is
+ * aborted. A heap starts out with MEM_CHECK_OFF (MEM_CHECK_FULL when built
+ * with UNIT_TEST).
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       level: Verification level.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapSetCheck(memHeap_t *heap, memCheck_t level)
+{
+	pthread_mutex_lock(&heap->lock);
+	heap->check = level;
+	heap->checkOps = 0;
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to make the calling thread the owner of a heap, or to leave the
+ * heap without an owner.
+ *
+ * @note
+ * Frees by threads other than the owner go through the heap's lock-free
+ * remote free queue, so that a thread that frees what another allocates
+ * does not contend with it for the lock. A heap starts out without an
+ * owner, in which case every free takes the lock.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       own: TRUE to make calling thread the owner, FALSE for no owner.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapSetOwner(memHeap_t *heap, int own)
+{
+	pthread_mutex_lock(&heap->lock);
+	heapDrain(heap);
+	heap->owner = pthread_self();
+	__atomic_store_n(&heap->owned, own, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to set the size from which allocations from a heap are large.
+ *
+ * @note
+ * A large block is not carved from the regions of the heap. It is a
+ * mapping of its own (a span), obtained with mmap() and returned with
+ * munmap() when freed, so that huge buffers neither fragment the heap
+ * nor fail for want of a large enough free block. A heap starts out with
+ * MEM_LARGE_MIN.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       size: Smallest large allocation, 0 to never map spans.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapSetLarge(memHeap_t *heap, int size)
+{
+	pthread_mutex_lock(&heap->lock);
+	heap->largeMin = size;
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to set the debug features of a heap.
+ *
+ * @note
+ * With MEM_DEBUG_REDZONE, memory given out is put between canaries,
+ * which are checked when it is freed or resized. With MEM_DEBUG_GUARD,
+ * large memory (see memHeapSetLarge()) ends at an inaccessible page, so
+ * that an overrun of it faults at once. An overrun, a bad or a double
+ * free is reported on stderr, with the address of the memory and, where
+ * known, the return address of the call that allocated it, and the
+ * program is aborted. Memory of batches and of alignments beyond
+ * MEM_ALIGN is not put between canaries, and thread caches are bypassed
+ * while the default heap has debug features. A heap starts out with
+ * none. Not supported with compact MCBs.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       flags: MEM_DEBUG_* flags, or'ed together.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if debug blocks are not supported
+ */
+int
+memHeapSetDebug(memHeap_t *heap, int flags)
+{
+#ifdef MEM_COMPACT_HDR
+	if (flags) {
+		return (-1);
+	}
+#endif /* MEM_COMPACT_HDR */
+	pthread_mutex_lock(&heap->lock);
+	heap->debug = flags;
+	pthread_mutex_unlock(&heap->lock);
+	return 0;
+}
+
+/**
+ * @brief
+ * API to walk all the memory blocks of a heap in address order.
+ *
+ * @note
+ * The heap is locked for the duration of the walk, so 'fn' must not
+ * call into the heap.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *       fn: Function called for each block.
+ *       arg: Opaque argument passed on to 'fn'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapWalk(memHeap_t *heap, memWalk_t fn, void *arg)
+{
+	region_t *r;
+	mcb_t	*m;
+
+	pthread_mutex_lock(&heap->lock);
+	for (r = heap->regions; r; r = r->next) {
+		for (m = r->mcb; m; m = mcbNext(heap, m)) {
+			fn(mcbAddr(m), MCB_SIZE(m),
+			   MCB_MAGIC(m) != MAGIC_FREE, arg);
+		}
+	}
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * Get statistics of a heap. Caller must hold the heap's lock.
+ *
+ * @note
+ * The largest free block is in the highest non-empty bin, so only that
+ * one bin is searched.
+ *
+ * @param[in]
+ *       h: Heap.
+ *
+ * @param[out]
+ *       st: Statistics of heap.
+ *
+ * @return
+ *       - None.
+ */
+static void
+heapStats(memHeap_t *h, memStats_t *st)
+{
+	freelist_links_t *mf;
+	mcb_t	*m;
+	int	fl, sl;
+
+	st->allocs = h->cnt.allocs;
+	st->frees = h->cnt.frees;
+	st->failures = h->cnt.failures;
+	st->usedBytes = h->cnt.usedBytes;
+	st->usedBlocks = h->cnt.usedBlocks;
+	st->cachedBytes = 0;
+	st->cachedBlocks = 0;
+	st->freeBlocks = h->cnt.freeBlocks;
+	st->freeBytes = h->capacity - h->cnt.usedBytes -
+			(h->cnt.usedBlocks + h->cnt.freeBlocks) * sizeof(mcb_t);
+	st->largeBlocks = __atomic_load_n(&h->largeBlocks, __ATOMIC_RELAXED);
+	st->largeBytes = __atomic_load_n(&h->largeBytes, __ATOMIC_RELAXED);
+	st->largestFree = 0;
+	if (h->flMap) {
+		fl = 31 - __builtin_clz(h->flMap);
+		sl = 31 - __builtin_clz(h->slMap[fl]);
+		for (m = h->freeBins[fl * SL_COUNT + sl]; m; m = mf->next) {
+			mf = mcbAddr(m);
+			if (MCB_SIZE(m) > st->largestFree) {
+				st->largestFree = MCB_SIZE(m);
+			}
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * API to return the memory of free blocks of a heap to the OS.
+ *
+ * @note
+ * For every free block, the whole pages between its free bin links and
+ * its foot are given up with madvise(MADV_DONTNEED), so they no longer
+ * take up physical memory. The block itself stays in the heap as is,
+ * and its pages are faulted back in, zero-filled, when it is next
+ * used. The regions of the heap must therefore be private anonymous
+ * memory (such as a static array, or an anonymous mmap()). This takes
+ * time in the number of free blocks, and pages given up earlier are
+ * given up again, which is cheap.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Number of bytes given up.
+ */
+long
+memHeapPurge(memHeap_t *heap)
+{
+	freelist_links_t *mf;
+	uint32_t flMap, slMap;
+	mcb_t	*m;
+	char	*start, *end;
+	size_t	page = sysconf(_SC_PAGESIZE);
+	long	purged = 0;
+	int	fl, sl;
+
+	pthread_mutex_lock(&heap->lock);
+	heapDrain(heap);
+	for (flMap = heap->flMap; flMap; flMap &= flMap - 1) {
+		fl = __builtin_ctz(flMap);
+		for (slMap = heap->slMap[fl]; slMap; slMap &= slMap - 1) {
+			sl = __builtin_ctz(slMap);
+			for (m = heap->freeBins[fl * SL_COUNT + sl]; m;
+			     m = mf->next) {
+				mf = mcbAddr(m);
+				start = ALIGN_UP((char *) (mf + 1), page);
+				end = ALIGN_DOWN((char *) mf + MCB_SIZE(m) -
+						 sizeof(int), page);
+				if ((end > start) &&
+				    (madvise(start, end - start,
+					     MADV_DONTNEED) == 0)) {
+					purged += end - start;
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&heap->lock);
+	return purged;
+}
+
+/**
+ * @brief
+ * API to get statistics of a heap.
+ *
+ * @note
+ * This is O(1) in the number of blocks, apart from the search of one
+ * free bin for the largest free block.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *
+ * @param[out]
+ *       st: Statistics of heap.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapStats(memHeap_t *heap, memStats_t *st)
+{
+	pthread_mutex_lock(&heap->lock);
+	heapStats(heap, st);
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to get a histogram of the blocks of a heap by size.
+ *
+ * @note
+ * This walks every block of the heap, in address order, with the heap
+ * locked. Bucket 'b' counts blocks of 2^b to 2^(b+1)-1 bytes.
+ *
+ * @param[in]
+ *       heap: Heap.
+ *
+ * @param[out]
+ *       hist: Histogram of heap.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHeapHistogram(memHeap_t *heap, memHist_t *hist)
+{
+	region_t *r;
+	mcb_t	*m;
+	int	b;
+
+	memset(hist, 0, sizeof(*hist));
+	pthread_mutex_lock(&heap->lock);
+	for (r = heap->regions; r; r = r->next) {
+		for (m = r->mcb; m; m = mcbNext(heap, m)) {
+			b = 31 - __builtin_clz((uint32_t) MCB_SIZE(m));
+			if (MCB_MAGIC(m) != MAGIC_FREE) {
+				hist->usedBlocks[b]++;
+			} else {
+				hist->freeBlocks[b]++;
+				hist->freeBytes[b] += MCB_SIZE(m);
+			}
+		}
+	}
+	pthread_mutex_unlock(&heap->lock);
+	return;
+}
+
+/**
+ * @brief
+ * API to map memory for heap regions, backed by huge pages if possible.
+ *
+ * @note
+ * Huge pages cut down the TLB misses of walks over the blocks of a
+ * large heap. Explicit huge pages (MAP_HUGETLB) are tried first. These
+ * are there only if the system has reserved them. Failing that, the
+ * memory is aligned to a huge page and marked for transparent huge
+ * pages (MADV_HUGEPAGE), which the kernel may or may not honour. Else
+ * the memory is left with normal pages. A region passed to memInit()
+ * and the like is limited to INT_MAX bytes, so larger mappings are to
+ * be handed to a heap as several regions (see memHeapAddRegion()).
+ *
+ * @param[in]
+ *       size: Number of bytes needed. It is rounded up to a multiple of
+ *             the size of a huge page.
+ *
+ * @param[out]
+ *       pages: Kind of pages obtained, if not NULL.
+ *
+ * @return
+ *       - Success : Start address of mapping, aligned to a huge page
+ *       - Failure : NULL
+ */
+void *
+memMapPages(long size, memPages_t *pages)
+{
+	char	*p, *a;
+	size_t	len, extra;
+
+	len = ((size_t) size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		if (pages) {
+			*pages = MEM_PAGES_HUGETLB;
+		}
+		return p;
+	}
+
+	/* Map a huge page more than needed, and trim it to alignment. */
+	p = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	a = ALIGN_UP(p, HUGE_PAGE);
+	if (a != p) {
+		munmap(p, a - p);
+	}
+	extra = HUGE_PAGE - (a - p);
+	if (extra) {
+		munmap(a + len, extra);
+	}
+	if (pages) {
+		*pages = (madvise(a, len, MADV_HUGEPAGE) == 0) ?
+			 MEM_PAGES_THP : MEM_PAGES_NORMAL;
+	}
+	return a;
+}
+
+/**
+ * @brief
+ * API to unmap memory mapped by memMapPages().
+ *
+ * @param[in]
+ *       addr: Start address of mapping.
+ *       size: Number of bytes, as passed to memMapPages().
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memUnmapPages(void *addr, long size)
+{
+	if (!addr) return;
+
+	munmap(addr, ((size_t) size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+	return;
+}
+
+/**
+ * @brief
+ * Initialize a region of memory that needs to be managed.
+ *
+ * @note
+ * This function MUST be called before memAlloc() and memFree()
+ * API functions are invoked. It is the same as memInitMode() with
+ * MEM_MODE_BINS.
+ *
+ * @param[in]
+ *       addr: Start address of region of memory to be managed.
+ *       size: Size of region of memory to be managed.
+ *
+ * @param[out]
+ *       None
+ *
+ * @return
+ *       - None
+ */
+void
+memInit(void *addr, int size)
+{
+	memInitMode(addr, size, MEM_MODE_BINS);
+	return;
+}
+
+/**
+ * @brief
+ * Initialize a region of memory that needs to be managed by the default
+ * heap, choosing the engine used to keep track of free blocks.
+ *
+ * @note
+ * MEM_MODE_BINS is worst-fit over power-of-two size classes.
+ * MEM_MODE_TLSF is Two-Level Segregated Fit, which bounds both
+ * memAlloc() and memFree() to O(1) in the worst case: allocation does a
+ * fixed number of bit-scans and never walks a list, and freeing does at
+ * most two merges, each with an O(1) unlink and one O(1) insert.
+ *
+ * @param[in]
+ *       addr: Start address of region of memory to be managed.
+ *       size: Size of region of memory to be managed.
+ *       mode: Free block management engine to use.
+ *
+ * @param[out]
+ *       None
+ *
+ * @return
+ *       - None
+ */
+void
+memInitMode(void *addr, int size, memMode_t mode)
+{
+	pthread_mutex_lock(&defaultHeap.lock);
+	pthread_mutex_lock(&depotLock);
+	/* Magazines and blocks cached by threads belong to the old heap. */
+	memset(depot, 0, sizeof(depot));
+	pthread_mutex_lock(&tcacheListLock);
+	memset(&tcacheRetired, 0, sizeof(tcacheRetired));
+	heapGen++;
+	pthread_mutex_unlock(&tcacheListLock);
+	pthread_mutex_unlock(&depotLock);
+	/* So are samples. */
+	pthread_mutex_lock(&profLock);
+	profLive = NULL;
+	pthread_mutex_unlock(&profLock);
+	heapInit(&defaultHeap, addr, size, mode);
+	pthread_mutex_unlock(&defaultHeap.lock);
+	return;
+}
+
+/**
+ * @brief
+ * Destructor of "tcacheKey". Returns the exiting thread's cache.
+ *
+ * @param[in]
+ *       arg: Pointer to thread cache.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+tcacheDestroy(void *arg)
+{
+	tcache_t *tc = arg;
+
+	memTcacheFlush();
+	pthread_mutex_lock(&tcacheListLock);
+	if (tc->gen == heapGen) {
+		tcacheRetired.allocs += tc->cnt.allocs;
+		tcacheRetired.frees += tc->cnt.frees;
+		tcacheRetired.flushed += tc->cnt.flushed;
+		tcacheRetired.cachedBytes += tc->cnt.cachedBytes;
+	}
+	if (tc->next) {
+		tc->next->prevTc = tc->prevTc;
+	}
+	if (tc->prevTc) {
+		tc->prevTc->next = tc->next;
+	} else {
+		tcacheList = tc->next;
+	}
+	pthread_mutex_unlock(&tcacheListLock);
+	return;
+}
+
+/**
+ * @brief
+ * Create the key whose destructor flushes thread caches.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+tcacheKeyCreate(void)
+{
+	pthread_key_create(&tcacheKey, tcacheDestroy);
+	return;
+}
+
+/**
+ * @brief
+ * Get the calling thread's cache, resetting it if the heap has been
+ * re-initialized since the cache was last used.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Pointer to thread cache.
+ */
+static tcache_t *
+tcacheGet(void)
+{
+	tcache_t *tc = &tcache;
+
+	pthread_once(&tcacheKeyOnce, tcacheKeyCreate);
+	if (tc->gen != heapGen) {
+		memset(tc->loaded, 0, sizeof(tc->loaded));
+		memset(tc->prev, 0, sizeof(tc->prev));
+		pthread_mutex_lock(&tcacheListLock);
+		memset(&tc->cnt, 0, sizeof(tc->cnt));
+		tc->gen = heapGen;
+		pthread_mutex_unlock(&tcacheListLock);
+	}
+	if (!tc->registered) {
+		pthread_setspecific(tcacheKey, tc);
+		pthread_mutex_lock(&tcacheListLock);
+		tc->prevTc = NULL;
+		tc->next = tcacheList;
+		if (tcacheList) {
+			tcacheList->prevTc = tc;
+		}
+		tcacheList = tc;
+		pthread_mutex_unlock(&tcacheListLock);
+		tc->registered = TRUE;
+	}
+	return tc;
+}
+
+/**
+ * @brief
+ * Return all the blocks in a magazine to the default heap with one
+ * acquisition of its lock.
+ *
+ * @param[in]
+ *       tc: Cache of calling thread.
+ *       mag: Magazine to be emptied.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+magFlush(tcache_t *tc, magazine_t *mag)
+{
+	long	bytes = 0;
+	int	i;
+
+	pthread_mutex_lock(&defaultHeap.lock);
+	for (i = 0; i < mag->count; i++) {
+		bytes += MCB_SIZE((mcb_t *) mag->objs[i] - 1);
+		heapFree(&defaultHeap, mag->objs[i]);
+	}
+	pthread_mutex_unlock(&defaultHeap.lock);
+	TC_STAT_ADD(tc->cnt.flushed, mag->count);
+	TC_STAT_ADD(tc->cnt.cachedBytes, -bytes);
+	mag->count = 0;
+	return;
+}
+
+/**
+ * @brief
+ * Allocate a block of a size class from the thread cache.
+ *
+ * @param[in]
+ *       c: Size class.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to block
+ *       - Failure : NULL, when neither the thread cache nor the depot
+ *                   has a block of this class
+ */
+static void *
+tcacheAlloc(int c)
+{
+	tcache_t *tc;
+	magazine_t *mag, *full;
+
+	tc = tcacheGet();
+	mag = tc->loaded[c];
+	if (mag && mag->count) {
+		return mag->objs[--mag->count];
+	}
+	if (tc->prev[c] && tc->prev[c]->count) {
+		tc->loaded[c] = tc->prev[c];
+		tc->prev[c] = mag;
+		mag = tc->loaded[c];
+		return mag->objs[--mag->count];
+	}
+
+	/* Both magazines are empty. Exchange one for a full one. */
+	pthread_mutex_lock(&depotLock);
+	full = depot[c].full;
+	if (full) {
+		depot[c].full = full->next;
+		depot[c].nfull--;
+		if (tc->prev[c]) {
+			tc->prev[c]->next = depot[c].empty;
+			depot[c].empty = tc->prev[c];
+		}
+	}
+	pthread_mutex_unlock(&depotLock);
+	if (!full) {
+		return NULL;
+	}
+	tc->prev[c] = mag;
+	tc->loaded[c] = full;
+	return full->objs[--full->count];
+}
+
+/**
+ * @brief
+ * Free a block of a size class to the thread cache.
+ *
+ * @param[in]
+ *       c: Size class.
+ *       addr: Block to be freed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE : Block was cached
+ *       - FALSE : No magazine could be had, block must go to the heap
+ */
+static int
+tcacheFree(int c, void *addr)
+{
+	tcache_t *tc;
+	magazine_t *mag, *empty, *flush;
+
+	tc = tcacheGet();
+	mag = tc->loaded[c];
+	if (mag && (mag->count < MAG_SIZE)) {
+		mag->objs[mag->count++] = addr;
+		return TRUE;
+	}
+	if (tc->prev[c] && (tc->prev[c]->count == 0)) {
+		tc->loaded[c] = tc->prev[c];
+		tc->prev[c] = mag;
+		mag = tc->loaded[c];
+		mag->objs[mag->count++] = addr;
+		return TRUE;
+	}
+
+	/* Both magazines are full (or absent). Hand the previous one to the
+	 * depot and load an empty one. If the depot already holds enough
+	 * full magazines, the previous one is flushed to the heap instead.
+	 */
+	flush = NULL;
+	pthread_mutex_lock(&depotLock);
+	if (tc->prev[c]) {
+		if (depot[c].nfull < DEPOT_MAX) {
+			tc->prev[c]->next = depot[c].full;
+			depot[c].full = tc->prev[c];
+			depot[c].nfull++;
+		} else {
+			flush = tc->prev[c];
+		}
+		tc->prev[c] = NULL;
+	}
+	empty = NULL;
+	if (!flush && depot[c].empty) {
+		empty = depot[c].empty;
+		depot[c].empty = empty->next;
+	}
+	pthread_mutex_unlock(&depotLock);
+
+	if (flush) {
+		magFlush(tc, flush);
+		empty = flush;
+	}
+	if (!empty) {
+		empty = memHeapAlloc(&defaultHeap, sizeof(magazine_t));
+		if (!empty) {
+			return FALSE;
+		}
+		empty->count = 0;
+	}
+	tc->prev[c] = mag;
+	tc->loaded[c] = empty;
+	empty->objs[empty->count++] = addr;
+	return TRUE;
+}
+
+/**
+ * @brief
+ * API to allocate memory.
+ *
+ * @note
+ * Requests of up to TC_MAX_SIZE bytes are first tried from the thread
+ * cache, which involves no lock in the common case. Other requests, and
+ * misses, go to the heap, which by default uses the worst-fit method
+ * wherein the allocation is done from a memory block of the largest size
+ * class (see memSetPolicy()). For better performance free blocks are kept
+ * in segregated size-class bins (see findFree()).
+ *
+ * @param[in]
+ *       size: Number of bytes of memory to be allocated.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to start of memory
+ *         area which has at least 'size' bytes of memory.
+ *       - On failure, NULL is returned.
+ */
+void *
+memAlloc(int size)
+{
+	void	*addr;
+	int	c;
+
+	if (defaultHeap.debug) {
+		return debugAlloc(&defaultHeap, size,
+				  __builtin_return_address(0));
+	}
+	if (profRate && ((tcache.profLeft -= size) < 0)) {
+		addr = profAlloc(size);
+		if (addr) {
+			return addr;
+		}
+	}
+	if (tcacheOn && (size <= TC_MAX_SIZE)) {
+		/* Class is that of the block size, as in memFree(), so
+		 * the block from the heap can be cached later.
+		 */
+		c = blockSize(size) / TC_GRAIN - 1;
+		addr = tcacheAlloc(c);
+		if (addr) {
+			TC_STAT_ADD(tcache.cnt.allocs, 1);
+			TC_STAT_ADD(tcache.cnt.cachedBytes,
+				    -MCB_SIZE((mcb_t *) addr - 1));
+			return addr;
+		}
+	}
+
+	return memHeapAlloc(&defaultHeap, size);
+}
+
+/**
+ * @brief
+ * API to allocate aligned memory.
+ *
+ * @param[in]
+ *       size: Number of bytes of memory to be allocated.
+ *       align: Alignment needed. Must be a power of 2.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On successful allocation, pointer to 'align' aligned memory
+ *         area which has at least 'size' bytes of memory. The memory
+ *         is freed with memFree().
+ *       - On failure, NULL is returned.
+ */
+void *
+memAllocAligned(int size, int align)
+{
+	if ((align > 0) && (align <= MEM_ALIGN)) {
+		return memAlloc(size);
+	}
+	return memHeapAllocAligned(&defaultHeap, size, align);
+}
+
+/**
+ * @brief
+ * API to free memory.
+ *
+ * @note
+ * Small blocks are kept in the thread cache for reuse by memAlloc().
+ * Others are merged back into the heap.
+ *
+ * @param[in]
+ *       addr: Start address of memory to be freed back.
+ *             The 'addr' must be same as what was returned by
+ *             memAlloc().
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memFree(void *addr)
+{
+	mcb_t	*m;
+	int	c;
+
+	if (!addr) return;
+
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (defaultHeap.debug || (MCB_MAGIC(m) == MAGIC_DEBUG)) {
+		debugFree(&defaultHeap, addr, __builtin_return_address(0));
+		return;
+	}
+	if (tcacheOn && (MCB_MAGIC(m) == MAGIC_USED)) {
+		/* A block satisfies every class up to its size. */
+		c = MCB_SIZE(m) / TC_GRAIN - 1;
+		if ((c < TC_CLASSES) && tcacheFree(c, addr)) {
+			TC_STAT_ADD(tcache.cnt.frees, 1);
+			TC_STAT_ADD(tcache.cnt.cachedBytes, MCB_SIZE(m));
+			return;
+		}
+	}
+
+	memHeapFree(&defaultHeap, addr);
+	return;
+}
+
+/**
+ * @brief
+ * API to allocate a number of memory blocks of the same size in one go.
+ *
+ * @note
+ * Batches go straight to the default heap, bypassing thread caches. The
+ * blocks may be freed with memFree() or memFreeBatch().
+ *
+ * @param[in]
+ *       size: Number of bytes of memory in each block.
+ *       n: Number of blocks.
+ *
+ * @param[out]
+ *       out: Pointers to memory allocated.
+ *
+ * @return
+ *       - Number of blocks allocated. It is less than 'n' if the heap
+ *         runs out of memory.
+ */
+int
+memAllocBatch(int size, int n, void **out)
+{
+	return memHeapAllocBatch(&defaultHeap, size, n, out);
+}
+
+/**
+ * @brief
+ * API to free a number of memory blocks in one go.
+ *
+ * @param[in]
+ *       addrs: Start addresses of memory to be freed back. NULL
+ *              entries are ignored.
+ *       n: Number of entries in 'addrs'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memFreeBatch(void **addrs, int n)
+{
+	memHeapFreeBatch(&defaultHeap, addrs, n);
+	return;
+}
+
+/**
+ * @brief
+ * API to change the size of allocated memory.
+ *
+ * @note
+ * The memory is resized in place when it is being shrunk, or when it
+ * is followed by a large enough free block. Only otherwise are the
+ * contents moved to a new memory area.
+ *
+ * @param[in]
+ *       addr: Start address of memory, as returned by memAlloc(),
+ *             or NULL to allocate new memory.
+ *       size: Number of bytes of memory needed. If 0, the memory
+ *             is freed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - On success, pointer to start of memory area which has at
+ *         least 'size' bytes of memory, with the contents of the old
+ *         area up to the lesser of the two sizes.
+ *       - On failure, NULL is returned and 'addr' is left untouched.
+ */
+void *
+memRealloc(void *addr, int size)
+{
+	mcb_t	*m;
+	void	*naddr;
+	int	inPlace, osize;
+
+	if (!addr) {
+		return memAlloc(size);
+	}
+	if (size <= 0) {
+		memFree(addr);
+		return NULL;
+	}
+	m = (mcb_t *) (addr - sizeof(*m));
+	if (defaultHeap.debug || (MCB_MAGIC(m) == MAGIC_DEBUG) ||
+	    (MCB_MAGIC(m) == MAGIC_PROF)) {
+		return debugRealloc(&defaultHeap, addr, size,
+				    __builtin_return_address(0));
+	}
+	if (MCB_MAGIC(m) == MAGIC_LARGE) {
+		return spanRealloc(&defaultHeap, (span_t *) addr - 1, size);
+	}
+
+	pthread_mutex_lock(&defaultHeap.lock);
+	if (MCB_MAGIC(m) != MAGIC_USED) {
+		pthread_mutex_unlock(&defaultHeap.lock);
+		return NULL;
+	}
+	inPlace = heapRealloc(&defaultHeap, m, size);
+	osize = MCB_SIZE(m);
+	pthread_mutex_unlock(&defaultHeap.lock);
+	if (inPlace) {
+		return addr;
+	}
+
+	/* Move through the thread cache front-end. */
+	naddr = memAlloc(size);
+	if (naddr) {
+		memcpy(naddr, addr, osize);
+		memFree(addr);
+	}
+	return naddr;
+}
+
+/**
+ * @brief
+ * API to set the placement policy of the default heap. Must be called
+ * after memInit(), which resets it to MEM_FIT_WORST.
+ *
+ * @param[in]
+ *       policy: Placement policy for subsequent allocations.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memSetPolicy(memPolicy_t policy)
+{
+	memHeapSetPolicy(&defaultHeap, policy);
+	return;
+}
+
+/**
+ * @brief
+ * API to set how much verification of the default heap is done by each
+ * operation (see memHeapSetCheck()). Must be called after memInit(),
+ * which resets it.
+ *
+ * @param[in]
+ *       level: Verification level.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memSetCheck(memCheck_t level)
+{
+	memHeapSetCheck(&defaultHeap, level);
+	return;
+}
+
+/**
+ * @brief
+ * API to set the size from which allocations from the default heap are
+ * large (see memHeapSetLarge()). Must be called after memInit(), which
+ * resets it.
+ *
+ * @param[in]
+ *       size: Smallest large allocation, 0 to never map spans.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memSetLarge(int size)
+{
+	memHeapSetLarge(&defaultHeap, size);
+	return;
+}
+
+/**
+ * @brief
+ * API to set the debug features of the default heap (see
+ * memHeapSetDebug()). Must be called after memInit(), which resets them.
+ *
+ * @param[in]
+ *       flags: MEM_DEBUG_* flags, or'ed together.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if debug blocks are not supported
+ */
+int
+memSetDebug(int flags)
+{
+	return memHeapSetDebug(&defaultHeap, flags);
+}
+
+/**
+ * @brief
+ * API to set how often memAlloc() samples allocations for the heap
+ * profiler (see memProfDump()).
+ *
+ * @note
+ * Allocations are sampled at random, one per 'rate' bytes allocated on
+ * average, and a sampled allocation records the stack of its caller.
+ * Memory that is not sampled pays only for a byte countdown, and nothing
+ * at all with profiling off. Samples taken stay live until freed, or
+ * until memInit(). Profiling starts out off.
+ *
+ * @param[in]
+ *       rate: Mean number of bytes between samples, 0 to stop sampling.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if sampled blocks are not supported
+ */
+int
+memProfSetRate(long rate)
+{
+#ifdef MEM_COMPACT_HDR
+	if (rate) {
+		return (-1);
+	}
+#endif /* MEM_COMPACT_HDR */
+	__atomic_add_fetch(&profGen, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&profRate, (rate > 0) ? rate : 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * @brief
+ * API to write out the heap profile, ie. the memory that is in use, by
+ * the stack that allocated it, as estimated from the live samples.
+ *
+ * @note
+ * The profile is in folded stack format, one line per stack, as taken
+ * by flamegraph.pl and pprof. A line has the frames of the stack,
+ * outermost first and separated by ';', then a space and the estimated
+ * number of bytes in use.
+ *
+ * @param[in]
+ *       fd: File descriptor to write to.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Number of stacks written.
+ */
+int
+memProfDump(int fd)
+{
+	profRec_t *rec = NULL;
+	prof_t	*p;
+	size_t	len = 0;
+	long	bytes;
+	int	i, j, cnt, max = 0, n = 0;
+
+	/* Copy the samples out, so that allocations are held up by the
+	 * lock only that long, and not while stacks are written. The copy
+	 * is mapped, as memory of the heap could be sampled in turn.
+	 */
+	for (;;) {
+		pthread_mutex_lock(&profLock);
+		cnt = 0;
+		for (p = profLive; p; p = p->next) {
+			if (cnt < max) {
+				memcpy(rec[cnt].stack, p->stack,
+				       sizeof(p->stack));
+				rec[cnt].weight = p->weight;
+			}
+			cnt++;
+		}
+		pthread_mutex_unlock(&profLock);
+		if (cnt <= max) break;
+
+		if (rec) {
+			munmap(rec, len);
+		}
+		max = cnt + cnt / 4 + 16;
+		len = max * sizeof(profRec_t);
+		rec = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (rec == MAP_FAILED) {
+			return 0;
+		}
+	}
+
+	/* Samples of a stack are next to each other once sorted. */
+	qsort(rec, cnt, sizeof(profRec_t), profRecCmp);
+	for (i = 0; i < cnt; i = j) {
+		bytes = 0;
+		for (j = i; (j < cnt) && !profRecCmp(&rec[i], &rec[j]); j++) {
+			bytes += rec[j].weight;
+		}
+		profWriteStack(fd, rec[i].stack);
+		dprintf(fd, " %ld\n", bytes);
+		n++;
+	}
+	if (rec) {
+		munmap(rec, len);
+	}
+	return n;
+}
+
+/**
+ * @brief
+ * API to add a region of memory to the default heap (see
+ * memHeapAddRegion()). Regions added are dropped by memInit().
+ *
+ * @param[in]
+ *       addr: Start address of region of memory to be added.
+ *       size: Size of region of memory to be added.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if region is too small
+ */
+int
+memAddRegion(void *addr, int size)
+{
+	return memHeapAddRegion(&defaultHeap, addr, size);
+}
+
+/**
+ * @brief
+ * API to walk all the memory blocks of the default heap in address order.
+ * Blocks held in thread caches are reported as used.
+ *
+ * @param[in]
+ *       fn: Function called for each block.
+ *       arg: Opaque argument passed on to 'fn'.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memWalk(memWalk_t fn, void *arg)
+{
+	memHeapWalk(&defaultHeap, fn, arg);
+	return;
+}
+
+/**
+ * @brief
+ * API to return the memory of free blocks of the default heap to the OS
+ * (see memHeapPurge()).
+ *
+ * @note
+ * Blocks held by thread caches are not free, and are not purged. Call
+ * memTcacheFlush() first to include the blocks of the calling thread.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Number of bytes given up.
+ */
+long
+memPurge(void)
+{
+	return memHeapPurge(&defaultHeap);
+}
+
+/**
+ * @brief
+ * API to get statistics of the default heap.
+ *
+ * @note
+ * Counts of the heap are combined with those of the thread caches,
+ * which are kept per thread, without a lock, and summed here. Blocks
+ * held by thread caches (or their depot) are reported as cached, not as
+ * used, and allocations and frees served by them are included. The
+ * magazines themselves are blocks of the heap, and are counted as such.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       st: Statistics of default heap.
+ *
+ * @return
+ *       - None.
+ */
+void
+memStats(memStats_t *st)
+{
+	tcacheCounters_t sum;
+	tcache_t *tc;
+	uint32_t gen;
+
+	pthread_mutex_lock(&defaultHeap.lock);
+	heapStats(&defaultHeap, st);
+	pthread_mutex_unlock(&defaultHeap.lock);
+
+	pthread_mutex_lock(&tcacheListLock);
+	sum = tcacheRetired;
+	gen = heapGen;
+	for (tc = tcacheList; tc; tc = tc->next) {
+		/* Counts of a cache not used since the heap was
+		 * initialized belong to the old heap.
+		 */
+		if (__atomic_load_n(&tc->gen, __ATOMIC_RELAXED) != gen) {
+			continue;
+		}
+		sum.allocs += __atomic_load_n(&tc->cnt.allocs,
+					      __ATOMIC_RELAXED);
+		sum.frees += __atomic_load_n(&tc->cnt.frees, __ATOMIC_RELAXED);
+		sum.flushed += __atomic_load_n(&tc->cnt.flushed,
+					       __ATOMIC_RELAXED);
+		sum.cachedBytes += __atomic_load_n(&tc->cnt.cachedBytes,
+						   __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&tcacheListLock);
+
+	/* A block flushed from a cache was counted as freed when it went
+	 * into the cache.
+	 */
+	st->allocs += sum.allocs;
+	st->frees += sum.frees - sum.flushed;
+	st->cachedBlocks = sum.frees - sum.allocs - sum.flushed;
+	st->cachedBytes = sum.cachedBytes;
+	st->usedBlocks -= st->cachedBlocks;
+	st->usedBytes -= st->cachedBytes;
+	return;
+}
+
+/**
+ * @brief
+ * API to get a histogram of the blocks of the default heap by size.
+ *
+ * @note
+ * Blocks held by thread caches are counted as used.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       hist: Histogram of default heap.
+ *
+ * @return
+ *       - None.
+ */
+void
+memHistogram(memHist_t *hist)
+{
+	memHeapHistogram(&defaultHeap, hist);
+	return;
+}
+
+/**
+ * @brief
+ * API to return all blocks cached by the calling thread to the heap.
+ *
+ * @note
+ * This is done automatically when a thread exits.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memTcacheFlush(void)
+{
+	tcache_t *tc;
+	magazine_t *mag;
+	int	c;
+
+	tc = tcacheGet();
+	for (c = 0; c < TC_CLASSES; c++) {
+		mag = tc->loaded[c];
+		if (mag) {
+			magFlush(tc, mag);
+			memHeapFree(&defaultHeap, mag);
+		}
+		mag = tc->prev[c];
+		if (mag) {
+			magFlush(tc, mag);
+			memHeapFree(&defaultHeap, mag);
+		}
+		tc->loaded[c] = tc->prev[c] = NULL;
+	}
+	return;
+}
+
+/**
+ * @brief
+ * API to turn the thread cache front-end of memAlloc()/memFree() on or
+ * off. Blocks already cached stay in the caches until flushed.
+ *
+ * @param[in]
+ *       on: TRUE to use thread caches, FALSE to always go to the heap.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+memTcacheEnable(int on)
+{
+	tcacheOn = on;
 	return;
 }
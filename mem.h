@@ -12,8 +12,118 @@
 #ifndef _MEM_H_
 #define _MEM_H_
 
+/* Alignment of all memory given out */
+#define MEM_ALIGN	16
+
+/* Default size from which allocations are mapped on their own */
+#define MEM_LARGE_MIN	(256 * 1024)
+
+/* Engine used to manage free memory blocks */
+typedef enum {
+	MEM_MODE_BINS = 0,	/* Power-of-two size bins */
+	MEM_MODE_TLSF		/* Two-Level Segregated Fit, O(1) worst case */
+} memMode_t;
+
+/* Placement policy of a MEM_MODE_BINS heap */
+typedef enum {
+	MEM_FIT_WORST = 0,	/* Block from the largest size class */
+	MEM_FIT_BEST,		/* Smallest block that fits */
+	MEM_FIT_FIRST		/* Lowest addressed block that fits */
+} memPolicy_t;
+
+/* Verification of a heap done by each operation */
+typedef enum {
+	MEM_CHECK_OFF = 0,	/* None */
+	MEM_CHECK_LOCAL,	/* O(1) checks of the block operated on */
+	MEM_CHECK_SAMPLED,	/* Local, plus a full walk now and then */
+	MEM_CHECK_FULL		/* Full walk of the heap, O(n) */
+} memCheck_t;
+
+/* Debug features of a heap */
+#define MEM_DEBUG_REDZONE	1	/* Canaries around memory given out */
+#define MEM_DEBUG_GUARD		2	/* Large memory ends at a guard page */
+
+/* Kind of pages backing memory mapped by memMapPages() */
+typedef enum {
+	MEM_PAGES_NORMAL = 0,	/* Base pages */
+	MEM_PAGES_THP,		/* Transparent huge pages, if kernel obliges */
+	MEM_PAGES_HUGETLB	/* Explicit (reserved) huge pages */
+} memPages_t;
+
+/* Function called for each block by a heap walk */
+typedef void (*memWalk_t) (void *addr, int size, int used, void *arg);
+
+/* Heap handle */
+typedef struct memHeap_ memHeap_t;
+
+/* Statistics of a heap. Byte counts exclude the MCB of each block. Large
+ * blocks are counted only by "largeBlocks" and "largeBytes".
+ */
+typedef struct memStats_ {
+	long	allocs;		/* Successful allocations */
+	long	frees;		/* Blocks freed */
+	long	failures;	/* Allocation requests that failed */
+	long	usedBytes;	/* Bytes in blocks in use */
+	long	usedBlocks;	/* Number of blocks in use */
+	long	cachedBytes;	/* Bytes in blocks held by thread caches */
+	long	cachedBlocks;	/* Number of blocks held by thread caches */
+	long	freeBytes;	/* Bytes in free blocks */
+	long	freeBlocks;	/* Number of free blocks */
+	long	largestFree;	/* Size of largest free block */
+	long	largeBlocks;	/* Number of large blocks (spans) */
+	long	largeBytes;	/* Bytes mapped for large blocks */
+} memStats_t;
+
+/* Histogram of the blocks of a heap. Bucket 'b' is for blocks of size
+ * 2^b to 2^(b+1)-1.
+ */
+#define MEM_HIST_BUCKETS	32
+typedef struct memHist_ {
+	long	usedBlocks[MEM_HIST_BUCKETS];	/* Blocks in use */
+	long	freeBlocks[MEM_HIST_BUCKETS];	/* Free blocks */
+	long	freeBytes[MEM_HIST_BUCKETS];	/* Bytes in free blocks */
+} memHist_t;
+
 void memInit(void *addr, int size);
+void memInitMode(void *addr, int size, memMode_t mode);
 void *memAlloc(int size);
+void *memAllocAligned(int size, int align);
 void memFree(void *addr);
+int memAllocBatch(int size, int n, void **out);
+void memFreeBatch(void **addrs, int n);
+void *memRealloc(void *addr, int size);
+void memSetPolicy(memPolicy_t policy);
+void memSetCheck(memCheck_t level);
+void memSetLarge(int size);
+int memSetDebug(int flags);
+int memProfSetRate(long rate);
+int memProfDump(int fd);
+int memAddRegion(void *addr, int size);
+void memWalk(memWalk_t fn, void *arg);
+void memTcacheFlush(void);
+void memTcacheEnable(int on);
+void *memMapPages(long size, memPages_t *pages);
+void memUnmapPages(void *addr, long size);
+void memStats(memStats_t *st);
+void memHistogram(memHist_t *hist);
+long memPurge(void);
+
+memHeap_t *memHeapCreate(void *addr, int size, memMode_t mode);
+void *memHeapAlloc(memHeap_t *heap, int size);
+void *memHeapAllocAligned(memHeap_t *heap, int size, int align);
+void memHeapFree(memHeap_t *heap, void *addr);
+int memHeapAllocBatch(memHeap_t *heap, int size, int n, void **out);
+void memHeapFreeBatch(memHeap_t *heap, void **addrs, int n);
+void *memHeapRealloc(memHeap_t *heap, void *addr, int size);
+void memHeapSetPolicy(memHeap_t *heap, memPolicy_t policy);
+void memHeapSetCheck(memHeap_t *heap, memCheck_t level);
+void memHeapSetOwner(memHeap_t *heap, int own);
+void memHeapSetLarge(memHeap_t *heap, int size);
+int memHeapSetDebug(memHeap_t *heap, int flags);
+int memHeapAddRegion(memHeap_t *heap, void *addr, int size);
+void memHeapWalk(memHeap_t *heap, memWalk_t fn, void *arg);
+void memHeapStats(memHeap_t *heap, memStats_t *st);
+void memHeapHistogram(memHeap_t *heap, memHist_t *hist);
+long memHeapPurge(memHeap_t *heap);
 
 #endif /* _MEM_H_ */
@@ -0,0 +1,693 @@
+/**
+ * @file      membench.c
+ * @brief     Benchmarks for toy kernel memory management.
+ *
+ * Run as "membench [name]" to run one benchmark, or with no argument
+ * to run all of them.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <mem.h>
+#include <arena.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+char space[64*1024*1024];
+
+/**
+ * @brief
+ * Get a monotonic time stamp.
+ *
+ * @return
+ *       - Time in nanoseconds.
+ */
+static uint64_t
+nsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ * @brief
+ * Cheap per-caller pseudo random numbers (xorshift).
+ *
+ * @param[in]
+ *       s: Random state, must not be 0.
+ *
+ * @param[out]
+ *       s: Updated random state.
+ *
+ * @return
+ *       - Next random number.
+ */
+static uint32_t
+rnd(uint32_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+#define THR_MAX		64	/* Largest number of threads to run */
+#define THR_OPS		1000000	/* Alloc or free operations per thread */
+#define THR_SLOTS	64	/* Live objects per thread */
+
+/**
+ * @brief
+ * Thread body for "threads" benchmark. Randomly allocates small objects
+ * into, and frees them from, a set of slots.
+ */
+static void *
+threadChurn(void *arg)
+{
+	void	*ptr[THR_SLOTS] = {0};
+	uint32_t seed = (uint32_t) (uintptr_t) arg * 2654435761U + 1;
+	int	i, idx;
+
+	for (i = 0; i < THR_OPS; i++) {
+		idx = rnd(&seed) % THR_SLOTS;
+		if (ptr[idx] == NULL) {
+			ptr[idx] = memAlloc(16 + rnd(&seed) % 240);
+		} else {
+			memFree(ptr[idx]);
+			ptr[idx] = NULL;
+		}
+	}
+	for (idx = 0; idx < THR_SLOTS; idx++) {
+		memFree(ptr[idx]);
+	}
+	return NULL;
+}
+
+/**
+ * @brief
+ * Scaling of small allocations with number of threads, with and without
+ * the per-thread magazine front-end.
+ */
+static void
+benchThreads(void)
+{
+	pthread_t tid[THR_MAX];
+	uint64_t t;
+	double	mops[2];
+	int	n, i, on;
+
+	printf("threads: %d alloc/free ops per thread\n", THR_OPS);
+	printf("%8s %16s %16s\n", "threads", "tcache Mops/s", "locked Mops/s");
+	for (n = 1; n <= THR_MAX; n *= 2) {
+		for (on = 1; on >= 0; on--) {
+			memInit(space, sizeof(space));
+			memTcacheEnable(on);
+			t = nsNow();
+			for (i = 0; i < n; i++) {
+				pthread_create(&tid[i], NULL, threadChurn,
+					       (void *) (uintptr_t) (i + 1));
+			}
+			for (i = 0; i < n; i++) {
+				pthread_join(tid[i], NULL);
+			}
+			t = nsNow() - t;
+			mops[!on] = (double) n * THR_OPS * 1000.0 / t;
+		}
+		printf("%8d %16.2f %16.2f\n", n, mops[0], mops[1]);
+	}
+	memTcacheEnable(1);
+	return;
+}
+
+#define FRAG_HEAP	(1*1024*1024)	/* Heap size, as used by memtest */
+#define FRAG_SLOTS	1000		/* Objects that may be live */
+#define FRAG_OPS	200000		/* Alloc or free operations */
+#define FRAG_SAMPLE	1000		/* Operations between samples */
+
+/**
+ * @brief
+ * Run the random churn of memtest on a fresh heap and print external
+ * fragmentation and allocation failure rate. External fragmentation is
+ * 1 - largest/total free, averaged over samples taken during the run.
+ */
+static void
+fragRun(const char *name, memMode_t mode, memPolicy_t policy, int maxSize)
+{
+	static void *ptr[FRAG_SLOTS];
+	memHeap_t *h;
+	memStats_t st;
+	uint32_t seed = 12345;
+	uint64_t t = 0, t0;
+	double	frag = 0;
+	int	i, idx, nalloc = 0, nfail = 0, nsample = 0;
+
+	h = memHeapCreate(space, FRAG_HEAP, mode);
+	memHeapSetPolicy(h, policy);
+	memset(ptr, 0, sizeof(ptr));
+	for (i = 0; i < FRAG_OPS; i++) {
+		t0 = nsNow();
+		idx = rnd(&seed) % FRAG_SLOTS;
+		if (ptr[idx] == NULL) {
+			ptr[idx] = memHeapAlloc(h, rnd(&seed) % maxSize);
+			nalloc++;
+			if (ptr[idx] == NULL) {
+				nfail++;
+			}
+		} else {
+			memHeapFree(h, ptr[idx]);
+			ptr[idx] = NULL;
+		}
+		t += nsNow() - t0;
+		if ((i % FRAG_SAMPLE) == FRAG_SAMPLE - 1) {
+			memHeapStats(h, &st);
+			if (st.freeBytes) {
+				frag += 1.0 - (double) st.largestFree /
+					st.freeBytes;
+			}
+			nsample++;
+		}
+	}
+	printf("%10s %10d %10d %8.2f %10.2f %10.1f\n", name, nalloc, nfail,
+	       100.0 * nfail / nalloc, 100.0 * frag / nsample,
+	       (double) t / FRAG_OPS);
+	return;
+}
+
+/**
+ * @brief
+ * Fragmentation and failure rate of each placement policy, under the
+ * churn of memtest (objects of up to 10000 bytes in a 1 MiB heap, which
+ * overcommits the heap) and a lighter variant (objects of up to 2000
+ * bytes).
+ */
+static void
+benchFrag(void)
+{
+	static const int maxSize[] = { 10000, 2000 };
+	int	s;
+
+	for (s = 0; s < sizeof(maxSize) / sizeof(maxSize[0]); s++) {
+		printf("frag: %d ops over %d slots, sizes 0-%d, %d KiB heap\n",
+		       FRAG_OPS, FRAG_SLOTS, maxSize[s] - 1, FRAG_HEAP / 1024);
+		printf("%10s %10s %10s %8s %10s %10s\n", "policy", "allocs",
+		       "failed", "fail%", "extfrag%", "ns/op");
+		fragRun("worst-fit", MEM_MODE_BINS, MEM_FIT_WORST, maxSize[s]);
+		fragRun("best-fit", MEM_MODE_BINS, MEM_FIT_BEST, maxSize[s]);
+		fragRun("first-fit", MEM_MODE_BINS, MEM_FIT_FIRST, maxSize[s]);
+		fragRun("tlsf", MEM_MODE_TLSF, MEM_FIT_WORST, maxSize[s]);
+	}
+	return;
+}
+
+#define BATCH_OBJS	(1 << 20)	/* Objects allocated per measurement */
+#define BATCH_SIZE	64		/* Size of each object */
+
+/**
+ * @brief
+ * Per-object cost of allocating and freeing bursts of objects one call
+ * at a time against memAllocBatch()/memFreeBatch(). The heap is first
+ * fragmented with some long-lived objects, so that freed blocks have
+ * neighbours to merge with.
+ */
+static void
+benchBatch(void)
+{
+	static void *ptr[256], *hold[4096];
+	static const int bursts[] = { 32, 64, 128, 256 };
+	uint64_t t;
+	double	ns[3];
+	int	b, i, j, n, got;
+
+	printf("batch: %d objects of %d bytes, ns per object (alloc+free)\n",
+	       BATCH_OBJS, BATCH_SIZE);
+	printf("%8s %10s %10s %10s\n", "burst", "single", "tcache", "batch");
+	for (b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++) {
+		n = bursts[b];
+		memInit(space, sizeof(space));
+		for (i = 0; i < 4096; i++) {
+			hold[i] = memAlloc(BATCH_SIZE + (i % 7) * 48);
+			if (i % 2) {
+				memFree(hold[i - 1]);
+			}
+		}
+
+		/* One call per object, heap only */
+		memTcacheEnable(0);
+		t = nsNow();
+		for (i = 0; i < BATCH_OBJS; i += n) {
+			for (j = 0; j < n; j++) {
+				ptr[j] = memAlloc(BATCH_SIZE);
+			}
+			for (j = 0; j < n; j++) {
+				memFree(ptr[j]);
+			}
+		}
+		ns[0] = (double) (nsNow() - t) / BATCH_OBJS;
+
+		/* One call per object, with thread cache */
+		memTcacheEnable(1);
+		t = nsNow();
+		for (i = 0; i < BATCH_OBJS; i += n) {
+			for (j = 0; j < n; j++) {
+				ptr[j] = memAlloc(BATCH_SIZE);
+			}
+			for (j = 0; j < n; j++) {
+				memFree(ptr[j]);
+			}
+		}
+		ns[1] = (double) (nsNow() - t) / BATCH_OBJS;
+		memTcacheFlush();
+
+		/* One call per burst */
+		t = nsNow();
+		for (i = 0; i < BATCH_OBJS; i += n) {
+			got = memAllocBatch(BATCH_SIZE, n, ptr);
+			memFreeBatch(ptr, got);
+		}
+		ns[2] = (double) (nsNow() - t) / BATCH_OBJS;
+		printf("%8d %10.1f %10.1f %10.1f\n", n, ns[0], ns[1], ns[2]);
+	}
+	return;
+}
+
+#define REMOTE_OBJS	(1 << 22)	/* Objects passed per measurement */
+#define REMOTE_RING	1024		/* Slots in producer/consumer ring */
+
+/* Ring of objects from producer to consumers of "remote" benchmark */
+static struct {
+	memHeap_t *heap;
+	void	*slot[REMOTE_RING];
+	unsigned long head;	/* Next slot to fill, by producer */
+	unsigned long tail;	/* Next slot to claim, by consumers */
+} ring;
+
+/**
+ * @brief
+ * Consumer thread of "remote" benchmark. Claims objects from the ring
+ * and frees them.
+ */
+static void *
+remoteConsumer(void *arg)
+{
+	unsigned long t;
+	void	*p;
+
+	for (;;) {
+		t = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+		if (t >= REMOTE_OBJS) {
+			break;
+		}
+		if (t == __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE)) {
+			sched_yield();
+			continue;
+		}
+		p = ring.slot[t % REMOTE_RING];
+		if (__atomic_compare_exchange_n(&ring.tail, &t, t + 1, 0,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_RELAXED)) {
+			memHeapFree(ring.heap, p);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief
+ * Producer/consumer throughput: one thread allocates objects from a heap
+ * and hands them over to other threads, which free them. Frees take the
+ * heap's lock, unless the producer owns the heap, in which case they go
+ * through its remote free queue.
+ */
+static void
+benchRemote(void)
+{
+	pthread_t tid[THR_MAX];
+	memHeap_t *h;
+	uint32_t seed = 1;
+	uint64_t t;
+	double	mops[2];
+	unsigned long i;
+	int	n, c, own;
+
+	printf("remote: %d objects from 1 producer to n consumers\n",
+	       REMOTE_OBJS);
+	printf("%8s %16s %16s\n", "consumers", "locked Mops/s", "remote Mops/s");
+	for (n = 1; n <= 8; n *= 2) {
+		for (own = 0; own <= 1; own++) {
+			h = memHeapCreate(space, sizeof(space), MEM_MODE_TLSF);
+			memHeapSetOwner(h, own);
+			ring.heap = h;
+			ring.head = ring.tail = 0;
+			t = nsNow();
+			for (c = 0; c < n; c++) {
+				pthread_create(&tid[c], NULL, remoteConsumer, NULL);
+			}
+			for (i = 0; i < REMOTE_OBJS; i++) {
+				while (i - __atomic_load_n(&ring.tail,
+							   __ATOMIC_ACQUIRE) >=
+				       REMOTE_RING) {
+					sched_yield();
+				}
+				ring.slot[i % REMOTE_RING] =
+					memHeapAlloc(h, 16 + rnd(&seed) % 240);
+				__atomic_store_n(&ring.head, i + 1,
+						 __ATOMIC_RELEASE);
+			}
+			for (c = 0; c < n; c++) {
+				pthread_join(tid[c], NULL);
+			}
+			t = nsNow() - t;
+			mops[own] = (double) REMOTE_OBJS * 1000.0 / t;
+		}
+		printf("%8d %16.2f %16.2f\n", n, mops[0], mops[1]);
+	}
+	return;
+}
+
+#define RSS_OBJS	16384	/* Objects allocated at peak */
+#define RSS_KEEP	64	/* One in this many objects outlives peak */
+
+/**
+ * @brief
+ * Get the resident set size of the process.
+ *
+ * @return
+ *       - RSS in KiB.
+ */
+static long
+rssKb(void)
+{
+	FILE	*f;
+	long	size, rss = 0;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf(f, "%ld %ld", &size, &rss) != 2) {
+			rss = 0;
+		}
+		fclose(f);
+	}
+	return (rss * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+/**
+ * @brief
+ * Resident memory of a heap after a peak, before and after its free
+ * memory is purged. The heap fills up with objects of random size,
+ * then all but a few scattered objects are freed.
+ */
+static void
+benchRss(void)
+{
+	static void *ptr[RSS_OBJS];
+	uint32_t seed = 1;
+	uint64_t t;
+	long	base, peak, after, purged;
+	int	i, size;
+
+	memInit(space, sizeof(space));
+	memSetLarge(0);
+	base = rssKb();
+	for (i = 0; i < RSS_OBJS; i++) {
+		size = 64 + rnd(&seed) % 8000;
+		ptr[i] = memAlloc(size);
+		if (ptr[i]) {
+			memset(ptr[i], 1, size);
+		}
+	}
+	peak = rssKb();
+	for (i = 0; i < RSS_OBJS; i++) {
+		if (i % RSS_KEEP) {
+			memFree(ptr[i]);
+		}
+	}
+	memTcacheFlush();
+	after = rssKb();
+	t = nsNow();
+	purged = memPurge();
+	t = nsNow() - t;
+	printf("rss: %d objects at peak, 1 in %d kept\n", RSS_OBJS, RSS_KEEP);
+	printf("%12s %12s %12s %12s %12s %10s\n", "base KiB", "peak KiB",
+	       "freed KiB", "purged KiB", "advised KiB", "purge us");
+	printf("%12ld %12ld %12ld %12ld %12ld %10.1f\n", base, peak, after,
+	       rssKb(), purged / 1024, t / 1000.0);
+	for (i = 0; i < RSS_OBJS; i += RSS_KEEP) {
+		memFree(ptr[i]);
+	}
+	memSetLarge(MEM_LARGE_MIN);
+	return;
+}
+
+#define REQ_COUNT	20000	/* Requests per measurement */
+#define REQ_OBJS	200	/* Objects allocated per request */
+
+/**
+ * @brief
+ * Per-object cost of memory of a request, whose objects are all freed
+ * at the end of the request, with memAlloc()/memFree() against an
+ * arena that is reset.
+ */
+static void
+benchArena(void)
+{
+	static void *ptr[REQ_OBJS];
+	uint32_t seed = 1;
+	arena_t *a;
+	uint64_t t;
+	double	ns[2];
+	int	r, i;
+
+	memInit(space, sizeof(space));
+	t = nsNow();
+	for (r = 0; r < REQ_COUNT; r++) {
+		for (i = 0; i < REQ_OBJS; i++) {
+			ptr[i] = memAlloc(16 + rnd(&seed) % 500);
+		}
+		for (i = 0; i < REQ_OBJS; i++) {
+			memFree(ptr[i]);
+		}
+	}
+	ns[0] = (double) (nsNow() - t) / (REQ_COUNT * REQ_OBJS);
+
+	a = arenaCreate(16384);
+	t = nsNow();
+	for (r = 0; r < REQ_COUNT; r++) {
+		for (i = 0; i < REQ_OBJS; i++) {
+			ptr[i] = arenaAlloc(a, 16 + rnd(&seed) % 500);
+		}
+		arenaReset(a);
+	}
+	ns[1] = (double) (nsNow() - t) / (REQ_COUNT * REQ_OBJS);
+	arenaDestroy(a);
+
+	printf("arena: %d requests of %d objects, ns per object\n",
+	       REQ_COUNT, REQ_OBJS);
+	printf("%12s %12s\n", "memAlloc", "arena");
+	printf("%12.1f %12.1f\n", ns[0], ns[1]);
+	return;
+}
+
+#define HUGE_HEAP	(512L * 1024 * 1024)	/* Size of heap */
+#define HUGE_SLOTS	200000			/* Objects that may be live */
+#define HUGE_OPS	2000000			/* Alloc or free operations */
+
+/**
+ * @brief
+ * Open a counter of data TLB misses of loads by this thread.
+ *
+ * @return
+ *       - Success : File descriptor of counter, counting disabled
+ *       - Failure : -1
+ */
+static int
+tlbOpen(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.size = sizeof(pe);
+	pe.type = PERF_TYPE_HW_CACHE;
+	pe.config = PERF_COUNT_HW_CACHE_DTLB |
+		    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+/**
+ * @brief
+ * Churn a heap that spans a large mapping, with a live set big enough
+ * that walks over its blocks miss in the TLB, and print time and TLB
+ * misses per operation.
+ */
+static void
+hugeRun(const char *name, char *mem)
+{
+	static void *ptr[HUGE_SLOTS];
+	memHeap_t *h;
+	uint32_t seed = 12345;
+	uint64_t t;
+	long long miss = -1;
+	int	i, idx, fd;
+
+	h = memHeapCreate(mem, HUGE_HEAP, MEM_MODE_BINS);
+	memHeapSetLarge(h, 0);
+	memset(ptr, 0, sizeof(ptr));
+	/* Fill the heap first, so the churn runs over all of it. */
+	for (i = 0; i < HUGE_SLOTS; i++) {
+		ptr[i] = memHeapAlloc(h, 16 + rnd(&seed) % 4000);
+	}
+	fd = tlbOpen();
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	t = nsNow();
+	for (i = 0; i < HUGE_OPS; i++) {
+		idx = rnd(&seed) % HUGE_SLOTS;
+		if (ptr[idx] == NULL) {
+			ptr[idx] = memHeapAlloc(h, 16 + rnd(&seed) % 4000);
+		} else {
+			memHeapFree(h, ptr[idx]);
+			ptr[idx] = NULL;
+		}
+	}
+	t = nsNow() - t;
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &miss, sizeof(miss)) != sizeof(miss)) {
+			miss = -1;
+		}
+		close(fd);
+	}
+	if (miss >= 0) {
+		printf("%10s %10.1f %12.3f\n", name, (double) t / HUGE_OPS,
+		       (double) miss / HUGE_OPS);
+	} else {
+		printf("%10s %10.1f %12s\n", name, (double) t / HUGE_OPS,
+		       "n/a");
+	}
+	for (i = 0; i < HUGE_SLOTS; i++) {
+		memHeapFree(h, ptr[i]);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Cost of churn over a large heap in base pages against one in memory
+ * from memMapPages(), which is backed by huge pages when the system
+ * allows. TLB misses are shown as n/a when hardware counters are not
+ * accessible (see /proc/sys/kernel/perf_event_paranoid).
+ */
+static void
+benchHuge(void)
+{
+	static const char *kind[] = { "normal", "thp", "hugetlb" };
+	memPages_t pages;
+	char	*mem;
+
+	printf("huge: %d ops over %d slots, sizes 16-4015, %ld MiB heap\n",
+	       HUGE_OPS, HUGE_SLOTS, HUGE_HEAP / (1024 * 1024));
+	printf("%10s %10s %12s\n", "pages", "ns/op", "dTLB miss/op");
+	mem = mmap(NULL, HUGE_HEAP, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != MAP_FAILED) {
+		madvise(mem, HUGE_HEAP, MADV_NOHUGEPAGE);
+		hugeRun(kind[MEM_PAGES_NORMAL], mem);
+		munmap(mem, HUGE_HEAP);
+	}
+	mem = memMapPages(HUGE_HEAP, &pages);
+	if (mem) {
+		hugeRun(kind[pages], mem);
+		memUnmapPages(mem, HUGE_HEAP);
+	}
+	return;
+}
+
+#define SMALL_HEAP	(1024 * 1024)	/* Size of heap */
+
+/**
+ * @brief
+ * Number of small objects of each size that fit in a heap, and the cost
+ * of allocating and then freeing all of them. Build with MEM_COMPACT_HDR
+ * (membench-compact) to compare header layouts.
+ */
+static void
+benchSmall(void)
+{
+	static void *ptr[SMALL_HEAP / 16];
+	static const int size[] = { 16, 24, 28, 32, 40, 44, 48 };
+	memHeap_t *h;
+	uint64_t t;
+	int	s, n, i;
+
+	printf("small: objects in a %d KiB heap\n", SMALL_HEAP / 1024);
+	printf("%10s %10s %12s %10s\n", "size", "objects", "bytes/object",
+	       "ns/op");
+	for (s = 0; s < sizeof(size) / sizeof(size[0]); s++) {
+		h = memHeapCreate(space, SMALL_HEAP, MEM_MODE_TLSF);
+		t = nsNow();
+		for (n = 0; n < SMALL_HEAP / 16; n++) {
+			ptr[n] = memHeapAlloc(h, size[s]);
+			if (!ptr[n]) break;
+		}
+		for (i = 0; i < n; i++) {
+			memHeapFree(h, ptr[i]);
+		}
+		t = nsNow() - t;
+		printf("%10d %10d %12.1f %10.1f\n", size[s], n,
+		       (double) SMALL_HEAP / n, (double) t / (2 * n));
+	}
+	return;
+}
+
+/* Table of benchmarks */
+static struct {
+	const char	*name;
+	void	(*fn)(void);
+} benches[] = {
+	{ "threads",	benchThreads },
+	{ "frag",	benchFrag },
+	{ "batch",	benchBatch },
+	{ "remote",	benchRemote },
+	{ "rss",	benchRss },
+	{ "arena",	benchArena },
+	{ "huge",	benchHuge },
+	{ "small",	benchSmall },
+};
+
+int
+main(int argc, char *argv[])
+{
+	int	i, found = 0;
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if ((argc < 2) || (strcmp(argv[1], benches[i].name) == 0)) {
+			benches[i].fn();
+			found = 1;
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "usage: %s [", argv[0]);
+		for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+			fprintf(stderr, "%s%s", i ? "|" : "", benches[i].name);
+		}
+		fprintf(stderr, "]\n");
+		return 1;
+	}
+	return 0;
+}
@@ -9,10 +9,59 @@
  */
 
 #include <mem.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
-char space[1*1024*1024];
+char space[1*1024*1024] __attribute__ ((aligned (MEM_ALIGN)));
+
+void *
+churn(void *arg)
+{
+	int i, idx;
+	void *ptr[100] = {0};
+	unsigned int seed = (unsigned long) arg;
+
+	for(i=0; i<20000; i++) {
+		idx = rand_r(&seed) % 100;
+		if (ptr[idx] == 0) {
+			ptr[idx] = memAlloc(rand_r(&seed) % 300);
+		} else {
+			memFree(ptr[idx]);
+			ptr[idx] = 0;
+		}
+	}
+	for(idx=0; idx<100; idx++) {
+		memFree(ptr[idx]);
+	}
+	return NULL;
+}
+
+/* Blocks handed to a remoteFreer() thread */
+typedef struct remoteArg_ {
+	memHeap_t *heap;
+	void **ptr;
+	int n;
+} remoteArg_t;
+
+void *
+remoteFreer(void *arg)
+{
+	remoteArg_t *ra = arg;
+	int i;
+
+	for(i=0; i<ra->n/2; i++) {
+		memHeapFree(ra->heap, ra->ptr[i]);
+	}
+	memHeapFreeBatch(ra->heap, ra->ptr + i, ra->n - i);
+	return NULL;
+}
 
 int
 main(void)
@@ -21,11 +70,17 @@ main(void)
 	{
 		void *ptr[4] = {0};
 
-		memInit(space, 610+(16*3)); /* 16 is sizeof(mcb_t) */
+		/* Blocks, with their MCB, are rounded up to MEM_ALIGN: 112 +
+		 * 208 + 320. The first MCB is placed so that memory given
+		 * out is aligned, and the region ends with a fence MCB,
+		 * which together take up 16 more bytes.
+		 */
+		memInit(space, 656);
 		ptr[0] = memAlloc(100);
 		ptr[1] = memAlloc(200);
 		ptr[2] = memAlloc(300);
 		ptr[3] = memAlloc(30); // Alloc must fail.
+		assert(ptr[2] != 0 && ptr[3] == 0);
 		memFree(ptr[0]);
 		memFree(ptr[2]);
 		memFree(ptr[1]);
@@ -62,4 +117,491 @@ main(void)
 			}
 		}
 	}
+	{
+		int i, sz, idx, p;
+		void *ptr[1000] = {0};
+
+		for(p=MEM_FIT_BEST; p<=MEM_FIT_FIRST; p++) {
+			memInit(space, sizeof(space));
+			memSetPolicy(p);
+			for(i=0; i<20000; i++) {
+				idx = random() % 1000;
+				if (ptr[idx] == 0) {
+					sz = random() % 10000;
+					ptr[idx] = memAlloc(sz);
+				} else {
+					memFree(ptr[idx]);
+					ptr[idx] = 0;
+				}
+			}
+			for(i=0; i<1000; i++) {
+				ptr[i] = 0;
+			}
+		}
+	}
+	{
+		int i, sz, idx;
+		void *ptr[1000] = {0};
+
+		memInitMode(space, sizeof(space), MEM_MODE_TLSF);
+		for(i=0; i<100000; i++) {
+			idx = random() % 1000;
+			if (ptr[idx] == 0) {
+				sz = random() % 10000;
+				ptr[idx] = memAlloc(sz);
+			} else {
+				memFree(ptr[idx]);
+				ptr[idx] = 0;
+			}
+		}
+	}
+	{
+		int i;
+		pthread_t tid[4];
+
+		memInit(space, sizeof(space));
+		for(i=0; i<4; i++) {
+			pthread_create(&tid[i], NULL, churn, (void *) (long) random());
+		}
+		for(i=0; i<4; i++) {
+			pthread_join(tid[i], NULL);
+		}
+		memTcacheFlush();
+	}
+	{
+		int i, align;
+		char *p[12];
+
+		memInit(space, sizeof(space));
+		for(i=0; i<12; i++) {
+			p[i] = memAlloc(random() % 100);
+			assert(((unsigned long) p[i] & (MEM_ALIGN - 1)) == 0);
+		}
+		for(i=0; i<12; i++) {
+			memFree(p[i]);
+			align = 1 << (i + 1);
+			p[i] = memAllocAligned(random() % 5000, align);
+			assert(((unsigned long) p[i] & (align - 1)) == 0);
+		}
+		assert(memAllocAligned(100, 48) == 0); // Not a power of 2.
+		for(i=0; i<12; i++) {
+			memFree(p[i]);
+		}
+	}
+	{
+		char *p, *q, *r;
+
+		memInit(space, sizeof(space));
+		memTcacheEnable(0);
+		p = memAlloc(1000);
+		memset(p, 'a', 1000);
+		q = memRealloc(p, 4000); // Grows in place.
+		assert(q == p && q[999] == 'a');
+		r = memAlloc(100);
+		q = memRealloc(q, 500); // Shrinks in place.
+		assert(q == p);
+		q = memRealloc(q, 3000); // Grows into freed tail.
+		assert(q == p);
+		q = memRealloc(q, 8000); // Must move, 'r' is in the way.
+		assert(q != p && q[0] == 'a' && q[499] == 'a');
+		memFree(r);
+		memFree(q);
+		memTcacheEnable(1);
+	}
+	{
+		int i, j, n, got;
+		void *ptr[256];
+
+		memInit(space, sizeof(space));
+		memTcacheEnable(0);
+		for(i=0; i<1000; i++) {
+			n = 1 + random() % 256;
+			got = memAllocBatch(random() % 300, n, ptr);
+			/* Free some singly, rest as a batch in random order. */
+			for(j=0; j<got; j++) {
+				if (random() % 4 == 0) {
+					memFree(ptr[j]);
+					ptr[j] = 0;
+				}
+			}
+			for(j=got-1; j>0; j--) {
+				void *p;
+				n = random() % (j + 1);
+				p = ptr[j]; ptr[j] = ptr[n]; ptr[n] = p;
+			}
+			memFreeBatch(ptr, got);
+		}
+		got = memAllocBatch(100000, 100, ptr); // Runs out of memory.
+		assert(got > 0 && got < 100);
+		memFreeBatch(ptr, got);
+		memTcacheEnable(1);
+	}
+	{
+		int i, j, idx;
+		memHeap_t *h[2];
+		void *ptr[2][100] = {{0}};
+
+		h[0] = memHeapCreate(space, sizeof(space)/2, MEM_MODE_BINS);
+		h[1] = memHeapCreate(space + sizeof(space)/2, sizeof(space)/2,
+				     MEM_MODE_TLSF);
+		memHeapCreate(space, 64, MEM_MODE_BINS); // Create must fail.
+		for(i=0; i<10000; i++) {
+			j = random() % 2;
+			idx = random() % 100;
+			if (ptr[j][idx] == 0) {
+				ptr[j][idx] = memHeapAlloc(h[j], random() % 1000);
+			} else if (random() % 2) {
+				ptr[j][idx] = memHeapRealloc(h[j], ptr[j][idx],
+							     random() % 2000);
+			} else {
+				memHeapFree(h[j], ptr[j][idx]);
+				ptr[j][idx] = 0;
+			}
+		}
+	}
+	{
+		int i, b;
+		void *ptr[100];
+		memStats_t st;
+		memHist_t hist;
+		long nused, nfree, freeBytes;
+
+		memInit(space, sizeof(space));
+		memSetLarge(0);
+		memStats(&st);
+		assert(st.allocs == 0 && st.usedBlocks == 0);
+		assert(st.freeBlocks == 1 && st.largestFree == st.freeBytes);
+		for(i=0; i<100; i++) {
+			ptr[i] = memAlloc(random() % 1000);
+		}
+		for(i=0; i<100; i+=2) {
+			memFree(ptr[i]);
+		}
+		assert(memAlloc(sizeof(space)) == 0);
+		/* Thread cache magazines are blocks of the heap too. */
+		memStats(&st);
+		assert(st.allocs >= 100 && st.frees == 50 && st.failures == 1);
+		assert(st.usedBlocks >= 50 && st.cachedBlocks >= 0);
+		memHistogram(&hist);
+		nused = nfree = freeBytes = 0;
+		for(b=0; b<MEM_HIST_BUCKETS; b++) {
+			nused += hist.usedBlocks[b];
+			nfree += hist.freeBlocks[b];
+			freeBytes += hist.freeBytes[b];
+		}
+		assert(nused == st.usedBlocks + st.cachedBlocks);
+		assert(nfree == st.freeBlocks && freeBytes == st.freeBytes);
+		for(i=1; i<100; i+=2) {
+			memFree(ptr[i]);
+		}
+		memTcacheFlush();
+		memStats(&st);
+		assert(st.allocs == st.frees && st.usedBlocks == 0);
+		assert(st.usedBytes == 0 && st.cachedBytes == 0);
+		assert(st.freeBlocks == 1 && st.largestFree == st.freeBytes);
+	}
+	{
+		int i, idx, status;
+		memCheck_t level;
+		void *ptr[100];
+		char *p, *q, *wild;
+		pid_t pid;
+
+		for(level=MEM_CHECK_OFF; level<MEM_CHECK_FULL; level++) {
+			memInit(space, sizeof(space));
+			memSetCheck(level);
+			memset(ptr, 0, sizeof(ptr));
+			for(i=0; i<100000; i++) {
+				idx = random() % 100;
+				if (ptr[idx] == 0) {
+					ptr[idx] = memAlloc(random() % 2000);
+				} else {
+					memFree(ptr[idx]);
+					ptr[idx] = 0;
+				}
+			}
+		}
+
+		/* An overrun into the next block must be caught. */
+		pid = fork();
+		if (pid == 0) {
+			close(2);
+			memInit(space, sizeof(space));
+			memSetCheck(MEM_CHECK_LOCAL);
+			p = memAlloc(1000);
+			memAlloc(1000);
+			memset(p, 0xff, 1008 + 16);
+			memFree(p);
+			_exit(0);
+		}
+		assert(waitpid(pid, &status, 0) == pid);
+		assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+
+		/* Bad bin links of a free neighbour must be caught before the
+		 * merge writes through them.
+		 */
+		wild = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		assert(wild != MAP_FAILED);
+		pid = fork();
+		if (pid == 0) {
+			close(2);
+			memInit(space, sizeof(space));
+			memSetCheck(MEM_CHECK_LOCAL);
+			p = memAlloc(1000);
+			q = memAlloc(1000);
+			memAlloc(1000);
+			memFree(q);
+			((char **) q)[0] = wild + 1024;	// Bin links
+			((char **) q)[1] = wild + 2048;
+			memFree(p);
+			_exit(0);
+		}
+		assert(waitpid(pid, &status, 0) == pid);
+		assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+		for(i=0; i<4096; i++) {
+			assert(wild[i] == 0);
+		}
+		munmap(wild, 4096);
+	}
+	{
+		static void *ptr[4000];
+		int i, idx;
+		void *own[100] = {0};
+		memHeap_t *h;
+		memStats_t st;
+		pthread_t tid[4];
+		remoteArg_t ra[4];
+
+		h = memHeapCreate(space, sizeof(space), MEM_MODE_TLSF);
+		memHeapSetOwner(h, 1);
+		for(i=0; i<4000; i++) {
+			ptr[i] = memHeapAlloc(h, random() % 200);
+		}
+		for(i=0; i<4; i++) {
+			ra[i].heap = h;
+			ra[i].ptr = ptr + i * 1000;
+			ra[i].n = 1000;
+			pthread_create(&tid[i], NULL, remoteFreer, &ra[i]);
+		}
+		/* Owner keeps allocating while others free. */
+		for(i=0; i<10000; i++) {
+			idx = random() % 100;
+			if (own[idx] == 0) {
+				own[idx] = memHeapAlloc(h, random() % 200);
+			} else {
+				memHeapFree(h, own[idx]);
+				own[idx] = 0;
+			}
+		}
+		for(i=0; i<4; i++) {
+			pthread_join(tid[i], NULL);
+		}
+		for(idx=0; idx<100; idx++) {
+			memHeapFree(h, own[idx]);
+		}
+		memHeapStats(h, &st);
+		assert(st.frees + st.usedBlocks == st.allocs);
+		memHeapFree(h, memHeapAlloc(h, 0)); // Drains the remote frees.
+		memHeapStats(h, &st);
+		assert(st.usedBlocks == 0 && st.freeBlocks == 1);
+
+		/* A block freed remotely twice is queued only once. */
+		ptr[0] = ptr[1] = memHeapAlloc(h, 100);
+		ra[0].ptr = ptr;
+		ra[0].n = 2;
+		pthread_create(&tid[0], NULL, remoteFreer, &ra[0]);
+		pthread_join(tid[0], NULL);
+		memHeapFree(h, memHeapAlloc(h, 0)); // Drains the remote frees.
+		memHeapStats(h, &st);
+		assert(st.usedBlocks == 0 && st.freeBlocks == 1);
+	}
+	{
+		static char more[2][64*1024] __attribute__ ((aligned (64)));
+		char *p, *q, *r, *big;
+		void *batch[3], *copy[3];
+		memStats_t st;
+
+		/* Large blocks are mapped, whatever the size of the heap. */
+		memInit(space, 64*1024);
+		big = memAlloc(sizeof(space));
+		assert(big != 0);
+		memset(big, 'b', sizeof(space));
+		big = memRealloc(big, 4*sizeof(space));
+		assert(big != 0 && big[sizeof(space)-1] == 'b');
+		memStats(&st);
+		assert(st.largeBlocks == 1 && st.largeBytes > 4*sizeof(space));
+		big = memRealloc(big, 2*sizeof(space)); // Shrinks the span.
+		assert(big != 0 && big[sizeof(space)-1] == 'b');
+		memStats(&st);
+		assert(st.largeBlocks == 1 && st.largeBytes > 2*sizeof(space) &&
+		       st.largeBytes < 4*sizeof(space));
+		big = memRealloc(big, 1000); // Moves into the heap.
+		assert(big != 0 && big[999] == 'b');
+		memStats(&st);
+		assert(st.largeBlocks == 0 && st.largeBytes == 0);
+		memFree(big);
+
+		/* A batch free leaves the addresses given as they are. */
+		batch[0] = memAlloc(100);
+		batch[1] = memAlloc(sizeof(space));
+		batch[2] = memAlloc(100);
+		memcpy(copy, batch, sizeof(batch));
+		memFreeBatch(batch, 3);
+		assert(memcmp(copy, batch, sizeof(batch)) == 0);
+		memStats(&st);
+		assert(st.largeBlocks == 0 && st.largeBytes == 0);
+
+		/* A heap grows by regions. */
+		memSetLarge(0);
+		p = memAlloc(60*1024);
+		assert(p != 0 && memAlloc(60*1024) == 0);
+		assert(memAddRegion(more[1], sizeof(more[1])) == 0);
+		assert(memAddRegion(more[0], sizeof(more[0])) == 0);
+		assert(memAddRegion(more[0], 16) == -1);
+		q = memAlloc(60*1024);
+		r = memAlloc(60*1024);
+		assert(q != 0 && r != 0);
+		memFree(p);
+		memFree(q);
+		memFree(r);
+		memStats(&st);
+		assert(st.usedBlocks == 0 && st.freeBlocks == 3);
+	}
+	{
+		int i;
+		char *ptr[64];
+
+		/* Purged free memory reads back as zero, live memory is
+		 * kept.
+		 */
+		memInit(space, sizeof(space));
+		memTcacheEnable(0);
+		for(i=0; i<64; i++) {
+			ptr[i] = memAlloc(12000);
+			memset(ptr[i], i + 1, 12000);
+		}
+		for(i=0; i<64; i+=2) {
+			memFree(ptr[i]);
+		}
+		assert(memPurge() >= 32 * 8192);
+		for(i=1; i<64; i+=2) {
+			assert(ptr[i][0] == i + 1 && ptr[i][11999] == i + 1);
+		}
+		memSetPolicy(MEM_FIT_FIRST); // Reuses the first freed block.
+		ptr[0] = memAlloc(12000);
+		assert(ptr[0][6000] == 0);
+		memFree(ptr[0]);
+		for(i=1; i<64; i+=2) {
+			memFree(ptr[i]);
+		}
+		memTcacheEnable(1);
+	}
+	{
+		memHeap_t *h;
+		memPages_t pages;
+		char *mem, *p;
+
+		/* A heap over memory mapped for huge pages, in whatever kind
+		 * the system allows.
+		 */
+		mem = memMapPages(3*1024*1024, &pages); // Rounds to 4 MiB
+		assert(mem != 0 && ((uintptr_t) mem & (2*1024*1024 - 1)) == 0);
+		h = memHeapCreate(mem, 4*1024*1024, MEM_MODE_TLSF);
+		assert(h != 0);
+		/* Served from the mapping, not by a span of its own. */
+		memHeapSetLarge(h, 0);
+		p = memHeapAlloc(h, 3*1024*1024);
+		assert(p != 0 && p >= mem &&
+		       p + 3*1024*1024 <= mem + 4*1024*1024);
+		memset(p, 1, 3*1024*1024);
+		memHeapFree(h, p);
+		memUnmapPages(mem, 3*1024*1024);
+	}
+	{
+		memStats_t st;
+		char *p, *q;
+		int i, status;
+		pid_t pid;
+
+		/* Debug heap: memory works as usual, while misuse is caught
+		 * and aborts, or faults at a guard page.
+		 */
+		memInit(space, sizeof(space));
+		memSetLarge(64*1024);
+		if (memSetDebug(MEM_DEBUG_REDZONE | MEM_DEBUG_GUARD) == 0) {
+			p = memAlloc(100);
+			memset(p, 7, 100);
+			p = memRealloc(p, 3000);
+			assert(p != 0 && p[0] == 7 && p[99] == 7);
+			q = memAlloc(100000);
+			assert(q != 0);
+			memset(q, 7, 100000);
+			q = memRealloc(q, 200000);
+			assert(q != 0 && q[99999] == 7);
+			memFree(p);
+			memFree(q);
+			memStats(&st);
+			assert(st.usedBlocks == 0 && st.largeBlocks == 0);
+
+			for(i=0; i<3; i++) {
+				pid = fork();
+				if (pid == 0) {
+					close(2);
+					p = memAlloc(100);
+					q = memAlloc(100000);
+					if (i == 0) {
+						p[100] = 0;	// Overrun
+					} else if (i == 1) {
+						memFree(p);	// Double free
+					} else {
+						q[100000] = 0;	// Guard page
+					}
+					memFree(p);
+					_exit(0);
+				}
+				assert(waitpid(pid, &status, 0) == pid);
+				assert(WIFSIGNALED(status));
+				assert(WTERMSIG(status) ==
+				       ((i < 2) ? SIGABRT : SIGSEGV));
+			}
+		}
+	}
+	{
+		static char *ptr[1000];
+		char buf[4096], *line;
+		long total;
+		int i, n, fds[2];
+
+		/* Heap profile: the live samples stand for the memory in
+		 * use, and go when it is freed.
+		 */
+		memInit(space, sizeof(space));
+		if (memProfSetRate(4096) == 0) {
+			for(i=0; i<1000; i++) {
+				ptr[i] = memAlloc(500);
+			}
+			for(i=0; i<1000; i+=10) {
+				ptr[i] = memRealloc(ptr[i], 400);
+			}
+			assert(pipe(fds) == 0);
+			assert(memProfDump(fds[1]) >= 1);
+			n = read(fds[0], buf, sizeof(buf) - 1);
+			assert(n > 0);
+			buf[n] = 0;
+			total = 0;
+			for (line = strtok(buf, "\n"); line;
+			     line = strtok(NULL, "\n")) {
+				total += atol(strrchr(line, ' ') + 1);
+			}
+			assert(total > 490000 / 2 && total < 490000 * 2);
+			for(i=0; i<1000; i++) {
+				memFree(ptr[i]);
+			}
+			assert(memProfDump(fds[1]) == 0);
+			close(fds[0]);
+			close(fds[1]);
+			memProfSetRate(0);
+		}
+	}
 }
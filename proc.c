@@ -10,15 +10,28 @@
  * @copyright Copyright (c) 2016, Natarajan Venkataraman
  */
 
+#define _GNU_SOURCE		/* For pthread_setaffinity_np() */
 #include <proc.h>
 #include <mem.h>
+#include <slab.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #define	STACKSZ	(128 * 1024)		/* Size of process stack */
 /* Magic# to recognize a PCB in the memory. */
 #define	MAGIC_PROC	0x50524F43	/* 'PROC' */
 
+#define	TRUE	1
+#define	FALSE	0
+
 typedef enum {
 	READY = 0,
 	RUNNING,
@@ -26,30 +39,1268 @@ typedef enum {
 	WAITING
 } procState_t;
 
-/* Process control block (PCB) */
-typedef struct proc_ {
-	struct proc_	*next;
-	uint32_t	magic;	/* Magic# for PCB */
-	int		pid;	/* Process ID */
-	procState_t	state;	/* Process state */
-	char	*stackAddr;	/* Address of stack assigned to process */
-	void	*resumeAddr;	/* Address to resume process execution from */
-	/* Registers */
-	char	*stackPtr;	/* Stack Pointer */
-	char	*framePtr;	/* Frame Pointer */
-} pcb_t;
+/* Initial MXCSR and x87 control word, as set up by the ABI at start */
+#define	MXCSR_INIT	0x1F80		/* All exceptions masked */
+#define	FPUCW_INIT	0x037F		/* All exceptions masked, 64-bit */
+
+/* Registers of a process that is not running. These are the registers
+ * a called function must preserve (SysV x86-64 ABI), so a switch made
+ * by a function call need save no others. The layout is known to
+ * ctxSwitch().
+ */
+typedef struct ctx_ {
+	void	*rsp;		/* Stack pointer, at return address */
+	uint64_t	rbx;
+	uint64_t	rbp;
+	uint64_t	r12;
+	uint64_t	r13;
+	uint64_t	r14;
+	uint64_t	r15;
+	uint32_t	mxcsr;	/* SSE control and status */
+	uint16_t	fpucw;	/* x87 control word */
+} ctx_t;
+
+_Static_assert(offsetof(ctx_t, mxcsr) == 56 && offsetof(ctx_t, fpucw) == 60,
+	       "ctx_t layout does not match ctxSwitch()");
+
+/* Process control block (PCB) */
+typedef struct proc_ {
+	struct proc_	*next;
+	uint32_t	magic;	/* Magic# for PCB */
+	int		pid;	/* Process ID */
+	procState_t	state;	/* Process state */
+	char	*stackAddr;	/* Address of stack assigned to process */
+	procStart_t	start;	/* Start function of process */
+	int	prio;		/* Priority, 0 being the highest */
+	ctx_t	ctx;		/* Registers, while not running */
+	/* Used with workers only, see procSetWorkers() */
+	struct proc_	*allNext;	/* Next in list of all processes */
+	struct proc_	*allPrev;	/* Previous in list of all processes */
+	struct worker_	*worker;	/* Worker that runs the process */
+	int	killed;		/* Deleted, freed at its next switch */
+} pcb_t;
+
+/* Ready queue of one priority */
+typedef struct runQ_ {
+	pcb_t	*head;		/* Next process to run */
+	pcb_t	*tail;		/* Last process to run */
+} runQ_t;
+
+static void sched(void);
+static void preemptTake(void);
+static struct worker_ *workerSelf(void);
+static void workerFinish(struct worker_ *w);
+void ctxSwitch(ctx_t *old, ctx_t *new);
+
+/**
+ * @brief
+ * Switch from one process to another: save the registers of the caller
+ * in 'old', load those in 'new', and return to where 'new' was saved.
+ *
+ * @note
+ * Written in assembly so that nothing but the ABI is relied upon: the
+ * compiler treats it as an ordinary call, which may clobber all the
+ * registers it does not save, so code around a switch can be compiled
+ * with any optimization.
+ *
+ * @param[in]
+ *       old: Where to save registers of the running process.
+ *       new: Registers of the process to run.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None, once the caller is switched back to.
+ */
+__asm__ (
+	"	.text\n"
+	"	.globl	ctxSwitch\n"
+	"	.type	ctxSwitch, @function\n"
+	"ctxSwitch:\n"
+	"	movq	%rsp, 0(%rdi)\n"
+	"	movq	%rbx, 8(%rdi)\n"
+	"	movq	%rbp, 16(%rdi)\n"
+	"	movq	%r12, 24(%rdi)\n"
+	"	movq	%r13, 32(%rdi)\n"
+	"	movq	%r14, 40(%rdi)\n"
+	"	movq	%r15, 48(%rdi)\n"
+	"	stmxcsr	56(%rdi)\n"
+	"	fnstcw	60(%rdi)\n"
+	"	movq	0(%rsi), %rsp\n"
+	"	movq	8(%rsi), %rbx\n"
+	"	movq	16(%rsi), %rbp\n"
+	"	movq	24(%rsi), %r12\n"
+	"	movq	32(%rsi), %r13\n"
+	"	movq	40(%rsi), %r14\n"
+	"	movq	48(%rsi), %r15\n"
+	"	ldmxcsr	56(%rsi)\n"
+	"	fldcw	60(%rsi)\n"
+	"	ret\n"
+	"	.size	ctxSwitch, .-ctxSwitch\n"
+);
+
+int procId = 0;			/* Counter used to generate process identifer */
+/* TODO: We are using a PID generation that is too simplistic and will
+ * wrap-over if too many processes are created. Need to replace with a
+ * correct implementation.
+ */
+
+runQ_t	readyQ[PROC_PRIO_COUNT];	/* Queues of ready to run processes,
+					 * one per priority
+					 */
+uint32_t	readyMap = 0;	/* Bit 'p' is set iff readyQ[p] is non-empty,
+				 * so the highest priority ready process is
+				 * found with one bit-scan
+				 */
+pcb_t	*runningProc = NULL;	/* Process that is currently running */
+
+slabCache_t	*pcbCache = NULL;	/* Cache of PCBs */
+ctx_t	deadCtx;		/* Registers of a deleted process, never
+				 * switched back to
+				 */
+pcb_t	*deadProc = NULL;	/* Process that deleted itself, whose stack
+				 * is freed once switched away from
+				 */
+
+/* Preemption. The timer signal switches processes only when the running
+ * process is outside of sections that must not be preempted, such as the
+ * code here; a tick that comes in such a section is taken at its end.
+ */
+volatile sig_atomic_t	preemptOff = 0;	/* Depth of such sections of the
+					 * running process
+					 */
+volatile sig_atomic_t	preemptPending = 0; /* A tick came in a section */
+int	preemptQuantum = 0;	/* Time slice in usec, 0 if preemption is off */
+
+/* Start and end a section not to be preempted, see procPreemptDisable().
+ * Inline, as every switch goes through them.
+ */
+#define	PREEMPT_OFF()	(preemptOff++)
+#define	PREEMPT_ON()						\
+	do {							\
+		if ((--preemptOff == 0) && preemptPending) {	\
+			preemptTake();				\
+		}						\
+	} while (0)
+
+/* Workers. After procSetWorkers(), processes are run by a number of
+ * threads, the workers, in place of the one thread of procInit(). Each
+ * worker has a deque of ready processes of its own, and takes from the
+ * deques of others when its own is empty.
+ */
+#define	DEQ_INIT	256	/* Initial slots of a deque */
+#define	IDLE_SPIN	64	/* Rounds an idle worker looks for processes
+				 * before it sleeps
+				 */
+
+/* Slots of a deque. A full array is replaced by one of twice the size;
+ * the old one is kept until the workers stop, as thieves may still be
+ * reading it.
+ */
+typedef struct dequeArray_ {
+	struct dequeArray_	*old;	/* Array this one replaced */
+	long	mask;		/* Number of slots - 1 */
+	pcb_t	*slot[];
+} dequeArray_t;
+
+/* Work stealing deque (Chase-Lev). Only its worker puts processes in,
+ * at the bottom; processes are taken out at the top, by any worker.
+ */
+typedef struct deque_ {
+	long	top __attribute__ ((aligned (64)));	/* Next to take */
+	long	bottom __attribute__ ((aligned (64)));	/* Next to fill */
+	dequeArray_t	*array;
+} deque_t;
+
+/* Worker */
+typedef struct worker_ {
+	deque_t	q;		/* Ready processes */
+	pcb_t	*running;	/* Process running, NULL when idle */
+	pcb_t	*prev;		/* Process switched away from, queued or
+				 * freed by the code switched to
+				 */
+	ctx_t	idleCtx;	/* Registers of idle loop, while not idle */
+	char	*idleStack;	/* Stack of idle loop, for worker 0 */
+	pthread_t	tid;	/* Thread, but for worker 0 */
+	uint32_t	seed;	/* Random state, to pick whom to steal from */
+	int	id;		/* Index in workerTab[] */
+} worker_t;
+
+worker_t	**workerTab = NULL;	/* Workers; 0 is the caller of
+					 * procSetWorkers()
+					 */
+int	workerCount = 0;	/* Workers, 0 when not in use */
+int	workerThreads = 0;	/* Workers with a thread started */
+int	workerStop = 0;		/* Set to let workers end */
+long	procCount = 0;		/* Processes, with workers */
+long	procLive = 0;		/* Processes not deleted, with workers */
+pcb_t	*procAll = NULL;	/* All processes, with workers */
+pcb_t	*procSpill = NULL;	/* Ready processes that no deque could
+				 * take, for want of memory
+				 */
+pcb_t	*workerHandoff = NULL;	/* Last process, passed to worker 0 as
+				 * the workers stop
+				 */
+/* Guards the PCB cache, procAll, procLive and procSpill, with workers */
+pthread_mutex_t	procLock = PTHREAD_MUTEX_INITIALIZER;
+/* Idle workers sleep on workerWake, counted in workerIdlers */
+pthread_mutex_t	workerIdleLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	workerWake = PTHREAD_COND_INITIALIZER;
+int	workerIdlers = 0;
+int	workerPinned = FALSE;	/* Workers are bound to a CPU each */
+cpu_set_t	workerCpus;	/* CPUs of the caller of procSetWorkers() */
+static __thread worker_t *curWorker;	/* Worker of this thread */
+
+/**
+ * @brief
+ * Free the stack and PCB of a process that deleted itself. Called by
+ * the process switched to, as the stack is in use until the switch.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+procReap(void)
+{
+	if (deadProc) {
+		memFree(deadProc->stackAddr);
+		slabFree(pcbCache, deadProc);
+		deadProc = NULL;
+	}
+	return;
+}
+
+/**
+ * @brief
+ * First code run by a new process. Runs its start function, and deletes
+ * the process should that return. Aborts if it is the last process,
+ * which cannot be deleted.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Does not return.
+ */
+static void
+procEntry(void)
+{
+	pcb_t	*self;
+
+	if (workerCount) {
+		/* The worker is read before the process can move. */
+		self = workerSelf()->running;
+		workerFinish(self->worker);
+	} else {
+		procReap();
+		/* The switch to a process is made with preemption off. */
+		preemptOff = 1;
+		PREEMPT_ON();
+		self = runningProc;
+	}
+	self->start();
+	procDelete(self->pid);
+	/* Refused, as no other process is left to run. */
+	abort();
+}
+
+/**
+ * @brief
+ * Set up a new PCB, so that the first switch to it runs procEntry().
+ *
+ * @param[in]
+ *       proc: PCB of new process, with its pid set.
+ *       stack: Stack of new process, STACKSZ bytes.
+ *       start: Start function of new process.
+ *       prio: Priority of new process.
+ *
+ * @param[out]
+ *       proc: Initialized PCB.
+ *
+ * @return
+ *       - None.
+ */
+static void
+pcbInit(pcb_t *proc, char *stack, procStart_t start, int prio)
+{
+	proc->magic = MAGIC_PROC;
+	proc->state = READY;
+	proc->stackAddr = stack;
+	proc->start = start;
+	proc->prio = prio;
+	proc->killed = FALSE;
+
+	/* The first switch to the process returns to procEntry(). The
+	 * return address is put so that the stack is 16 byte aligned at
+	 * the call, as the ABI wants.
+	 */
+	memset(&proc->ctx, 0, sizeof(proc->ctx));
+	proc->ctx.rsp = stack + STACKSZ - 16;
+	* (void **) proc->ctx.rsp = (void *) procEntry;
+	proc->ctx.mxcsr = MXCSR_INIT;
+	proc->ctx.fpucw = FPUCW_INIT;
+	return;
+}
+
+/**
+ * @brief
+ * Put a process into the ready queue of its priority.
+ *
+ * @param[in]
+ *       proc: Process to be queued.
+ *       first: TRUE to queue at the head, FALSE at the end.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+readyInsert(pcb_t *proc, int first)
+{
+	runQ_t	*q = &readyQ[proc->prio];
+
+	if (q->head == NULL) {
+		proc->next = NULL;
+		q->head = q->tail = proc;
+		readyMap |= 1U << proc->prio;
+	} else if (first) {
+		proc->next = q->head;
+		q->head = proc;
+	} else {
+		proc->next = NULL;
+		q->tail->next = proc;
+		q->tail = proc;
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Take a process out of the ready queue of its priority.
+ *
+ * @param[in]
+ *       proc: Process to be removed. Must be in its ready queue.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+readyRemove(pcb_t *proc)
+{
+	runQ_t	*q = &readyQ[proc->prio];
+	pcb_t	*prevProc;
+
+	if (proc == q->head) {
+		q->head = proc->next;
+		prevProc = NULL;
+	} else {
+		for (prevProc = q->head; prevProc->next != proc;
+		     prevProc = prevProc->next);
+		prevProc->next = proc->next;
+	}
+	if (proc == q->tail) {
+		q->tail = prevProc;
+	}
+	if (q->head == NULL) {
+		readyMap &= ~(1U << proc->prio);
+	}
+	proc->next = NULL;
+	return;
+}
+
+/**
+ * @brief
+ * Find a ready process.
+ *
+ * @param[in]
+ *       pid: Process ID.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to PCB
+ *       - Failure : NULL, if no ready process has that ID
+ */
+static pcb_t *
+readyFind(int pid)
+{
+	uint32_t	map;
+	pcb_t	*proc;
+
+	for (map = readyMap; map; map &= map - 1) {
+		for (proc = readyQ[__builtin_ctz(map)].head; proc;
+		     proc = proc->next) {
+			if (proc->pid == pid) {
+				return proc;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief
+ * Get the worker of the calling thread.
+ *
+ * @note
+ * Not inlined: a process may go on on another thread after a switch, so
+ * the worker must not be cached across one. After a switch, use the
+ * 'worker' of the PCB.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Worker of this thread.
+ */
+static worker_t * __attribute__ ((noinline))
+workerSelf(void)
+{
+	return curWorker;
+}
+
+/**
+ * @brief
+ * Put a process at the bottom of the deque of the calling worker.
+ *
+ * @param[in]
+ *       q: Deque of calling worker.
+ *       proc: Process to be queued.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if the deque is full and cannot grow
+ */
+static int
+dequePush(deque_t *q, pcb_t *proc)
+{
+	dequeArray_t *a, *n;
+	long	b, t, i;
+
+	b = q->bottom;
+	t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+	a = q->array;
+	if (b - t > a->mask) {
+		n = memAlloc(sizeof(dequeArray_t) +
+			     2 * (a->mask + 1) * sizeof(pcb_t *));
+		if (n == NULL) {
+			return (-1);
+		}
+		n->old = a;
+		n->mask = 2 * a->mask + 1;
+		for (i = t; i < b; i++) {
+			n->slot[i & n->mask] = a->slot[i & a->mask];
+		}
+		__atomic_store_n(&q->array, n, __ATOMIC_RELEASE);
+		a = n;
+	}
+	__atomic_store_n(&a->slot[b & a->mask], proc, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * @brief
+ * Take the process at the top of a deque.
+ *
+ * @note
+ * The worker of the deque takes from the top too, rather than from the
+ * bottom as in Chase-Lev, so that its processes run in turn, as they do
+ * without workers; a process that yields would otherwise be taken
+ * again at once.
+ *
+ * @param[in]
+ *       q: Deque, of any worker.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Process taken
+ *       - Failure : NULL, if the deque is empty or another worker took
+ *         the process first
+ */
+static pcb_t *
+dequeSteal(deque_t *q)
+{
+	dequeArray_t *a;
+	pcb_t	*proc;
+	long	t, b;
+
+	t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) {
+		return NULL;
+	}
+	a = __atomic_load_n(&q->array, __ATOMIC_ACQUIRE);
+	proc = __atomic_load_n(&a->slot[t & a->mask], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, FALSE,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+	return proc;
+}
+
+/**
+ * @brief
+ * Free the stack and PCB of a process, with workers.
+ *
+ * @param[in]
+ *       proc: Process to be freed. Must not be running or queued.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerFree(pcb_t *proc)
+{
+	memFree(proc->stackAddr);
+	pthread_mutex_lock(&procLock);
+	if (proc->allNext) {
+		proc->allNext->allPrev = proc->allPrev;
+	}
+	if (proc->allPrev) {
+		proc->allPrev->allNext = proc->allNext;
+	} else {
+		procAll = proc->allNext;
+	}
+	slabFree(pcbCache, proc);
+	pthread_mutex_unlock(&procLock);
+	__atomic_sub_fetch(&procCount, 1, __ATOMIC_RELEASE);
+	return;
+}
+
+/**
+ * @brief
+ * Wake workers sleeping in workerSleep().
+ *
+ * @param[in]
+ *       all: TRUE to wake all of them, FALSE for one.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerWakeUp(int all)
+{
+	pthread_mutex_lock(&workerIdleLock);
+	if (all) {
+		pthread_cond_broadcast(&workerWake);
+	} else {
+		pthread_cond_signal(&workerWake);
+	}
+	pthread_mutex_unlock(&workerIdleLock);
+	return;
+}
+
+/**
+ * @brief
+ * Check if an idle worker has anything to do: a process in a deque or
+ * in procSpill, or, as the workers stop, the last process to take for
+ * worker 0 and the end of its thread for the others.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - TRUE if it has, FALSE otherwise.
+ */
+static int
+workerBusy(worker_t *w)
+{
+	deque_t	*q;
+	int	i;
+
+	if (w->id ? __atomic_load_n(&workerStop, __ATOMIC_ACQUIRE) :
+	    (__atomic_load_n(&workerHandoff, __ATOMIC_ACQUIRE) != NULL)) {
+		return TRUE;
+	}
+	if (__atomic_load_n(&procSpill, __ATOMIC_ACQUIRE)) {
+		return TRUE;
+	}
+	for (i = 0; i < workerCount; i++) {
+		q = &workerTab[i]->q;
+		if (__atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE) >
+		    __atomic_load_n(&q->top, __ATOMIC_ACQUIRE)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+ * @brief
+ * Put an idle worker to sleep until a process is queued, or the workers
+ * stop. Returns at once if there is something to do already.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None, maybe without cause; the caller looks again.
+ */
+static void
+workerSleep(worker_t *w)
+{
+	pthread_mutex_lock(&workerIdleLock);
+	__atomic_add_fetch(&workerIdlers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!workerBusy(w)) {
+		pthread_cond_wait(&workerWake, &workerIdleLock);
+	}
+	__atomic_sub_fetch(&workerIdlers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&workerIdleLock);
+	return;
+}
+
+/**
+ * @brief
+ * Put a ready process in the deque of a worker, or in procSpill if the
+ * deque is full and cannot grow.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *       proc: Process to be queued.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerQueue(worker_t *w, pcb_t *proc)
+{
+	if (dequePush(&w->q, proc) < 0) {
+		pthread_mutex_lock(&procLock);
+		proc->next = procSpill;
+		__atomic_store_n(&procSpill, proc, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&procLock);
+	}
+	/* Pairs with the fence in workerSleep(): either the sleeper sees
+	 * the process, or this sees the sleeper.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&workerIdlers, __ATOMIC_RELAXED)) {
+		workerWakeUp(FALSE);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Finish a switch made by a worker: queue the process switched away
+ * from, or free it if it was deleted. Called by the code switched to,
+ * as the registers of that process are saved only by the switch. Once
+ * the workers stop, the process, the last one, goes to worker 0.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerFinish(worker_t *w)
+{
+	pcb_t	*proc = w->prev;
+
+	if (proc) {
+		w->prev = NULL;
+		if (__atomic_load_n(&proc->killed, __ATOMIC_RELAXED)) {
+			workerFree(proc);
+		} else if (w->id &&
+			   __atomic_load_n(&workerStop, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&workerHandoff, proc,
+					 __ATOMIC_RELEASE);
+			workerWakeUp(TRUE);
+		} else {
+			workerQueue(w, proc);
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Get the next process for a worker to run: the oldest in its own deque
+ * or, if 'steal' is TRUE and that is empty, one taken from another
+ * worker. Deleted processes met on the way are freed.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *       steal: TRUE to look beyond the worker's own deque.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Process to run
+ *       - Failure : NULL, if no ready process was found
+ */
+static pcb_t *
+workerPick(worker_t *w, int steal)
+{
+	worker_t *v;
+	pcb_t	*proc;
+	int	i, victim;
+
+	for (;;) {
+		proc = dequeSteal(&w->q);
+		if ((proc == NULL) && steal) {
+			/* Start at a random worker, so thieves spread out. */
+			w->seed ^= w->seed << 13;
+			w->seed ^= w->seed >> 17;
+			w->seed ^= w->seed << 5;
+			victim = w->seed % workerCount;
+			for (i = 0; (proc == NULL) && (i < workerCount); i++) {
+				v = workerTab[(victim + i) % workerCount];
+				if (v != w) {
+					proc = dequeSteal(&v->q);
+				}
+			}
+		}
+		if ((proc == NULL) && steal &&
+		    __atomic_load_n(&procSpill, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_lock(&procLock);
+			proc = procSpill;
+			if (proc) {
+				procSpill = proc->next;
+			}
+			pthread_mutex_unlock(&procLock);
+		}
+		if (proc == NULL) {
+			return NULL;
+		}
+		if (!__atomic_load_n(&proc->killed, __ATOMIC_RELAXED)) {
+			return proc;
+		}
+		workerFree(proc);
+	}
+}
+
+/**
+ * @brief
+ * Switch a worker from the running process to another, or to the idle
+ * loop of the worker if 'next' is NULL. The running process is queued,
+ * or freed if deleted, once switched away from.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *       self: Running process.
+ *       next: Process to run, or NULL.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None, once 'self' is switched back to, maybe by another
+ *         worker.
+ */
+static void
+workerSwitch(worker_t *w, pcb_t *self, pcb_t *next)
+{
+	w->prev = self;
+	w->running = next;
+	if (next) {
+		next->worker = w;
+		ctxSwitch(&self->ctx, &next->ctx);
+	} else {
+		ctxSwitch(&self->ctx, &w->idleCtx);
+	}
+	workerFinish(self->worker);
+	return;
+}
+
+/**
+ * @brief
+ * Idle loop of a worker. Looks for ready processes, in its own deque and
+ * those of other workers, and runs them. Entered whenever the worker has
+ * no process to run. A worker that finds none for IDLE_SPIN rounds
+ * sleeps until one is queued. Once the workers stop, worker 0 runs the
+ * last process, and the others end.
+ *
+ * @param[in]
+ *       w: Calling worker.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None, once told to stop; worker 0 does not stop.
+ */
+static void
+workerIdle(worker_t *w)
+{
+	pcb_t	*proc;
+	int	spin;
+
+	for (;;) {
+		workerFinish(w);
+		spin = 0;
+		for (;;) {
+			if (w->id) {
+				if (__atomic_load_n(&workerStop,
+						    __ATOMIC_ACQUIRE)) {
+					return;
+				}
+			} else if (__atomic_load_n(&workerHandoff,
+						   __ATOMIC_ACQUIRE)) {
+				proc = workerHandoff;
+				workerHandoff = NULL;
+				break;
+			}
+			if ((proc = workerPick(w, TRUE)) != NULL) {
+				break;
+			}
+			if (++spin < IDLE_SPIN) {
+				sched_yield();
+			} else {
+				workerSleep(w);
+				spin = 0;
+			}
+		}
+		w->running = proc;
+		proc->worker = w;
+		ctxSwitch(&w->idleCtx, &proc->ctx);
+	}
+}
+
+/**
+ * @brief
+ * Idle loop of worker 0, which runs on a stack of its own, as the thread
+ * of the worker is that of a process.
+ */
+static void
+workerIdle0(void)
+{
+	workerIdle(workerTab[0]);
+}
+
+/**
+ * @brief
+ * Thread of a worker other than worker 0.
+ */
+static void *
+workerThread(void *arg)
+{
+	worker_t *w = arg;
+
+	curWorker = w;
+	workerIdle(w);
+	return NULL;
+}
+
+/**
+ * @brief
+ * Yield, with workers: switch to the oldest process in the deque of the
+ * calling worker, if any, and queue the caller behind the others. A
+ * caller that has been deleted is switched away from for good.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerYield(void)
+{
+	worker_t *w = workerSelf();
+	pcb_t	*self = w->running, *next;
+
+	/* A process deleted by another goes at its next switch, even if
+	 * there is none else to run.
+	 */
+	if (__atomic_load_n(&self->killed, __ATOMIC_RELAXED)) {
+		workerSwitch(w, self, workerPick(w, TRUE));
+	}
+	next = workerPick(w, FALSE);
+	if (next) {
+		workerSwitch(w, self, next);
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Create a process, with workers. It runs at once on the calling worker,
+ * and the caller is queued.
+ *
+ * @param[in]
+ *       start: Pointer to start address of code for new process.
+ *       prio: Priority of new process.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Process ID of new process
+ *       - Failure : -1
+ */
+static int
+workerCreate(procStart_t start, int prio)
+{
+	worker_t *w;
+	pcb_t	*proc;
+	char	*stack;
+	int	pid;
+
+	stack = memAlloc(STACKSZ);
+	if (stack == NULL) {
+		return (-1);
+	}
+	pthread_mutex_lock(&procLock);
+	proc = slabAlloc(pcbCache);
+	if (proc) {
+		pid = proc->pid = procId++;
+		pcbInit(proc, stack, start, prio);
+		proc->allPrev = NULL;
+		proc->allNext = procAll;
+		if (procAll) {
+			procAll->allPrev = proc;
+		}
+		procAll = proc;
+		procLive++;
+	}
+	pthread_mutex_unlock(&procLock);
+	if (proc == NULL) {
+		memFree(stack);
+		return (-1);
+	}
+	__atomic_add_fetch(&procCount, 1, __ATOMIC_RELAXED);
+
+	w = workerSelf();
+	workerSwitch(w, w->running, proc);
+	return pid;
+}
+
+/**
+ * @brief
+ * Delete a process, with workers. A process deleting itself switches
+ * away for good. Any other process is marked, and is freed by the worker
+ * that next switches it in or out.
+ *
+ * @param[in]
+ *       pid: Process ID of process to delete.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if there is no such process, or it is the last
+ *         process not deleted
+ */
+static int
+workerDelete(int pid)
+{
+	worker_t *w = workerSelf();
+	pcb_t	*self = w->running, *proc;
+
+	/* Deleted processes wait to be freed, so only those not deleted
+	 * count: one must be left to run.
+	 */
+	pthread_mutex_lock(&procLock);
+	if (self->pid == pid) {
+		proc = self;
+	} else {
+		for (proc = procAll; proc; proc = proc->allNext) {
+			if (proc->pid == pid) {
+				break;
+			}
+		}
+	}
+	if (proc && !proc->killed) {
+		if (procLive == 1) {
+			pthread_mutex_unlock(&procLock);
+			return (-1);
+		}
+		__atomic_store_n(&proc->killed, TRUE, __ATOMIC_RELAXED);
+		procLive--;
+	}
+	pthread_mutex_unlock(&procLock);
+	if (proc == self) {
+		workerSwitch(w, self, workerPick(w, TRUE));
+		/* Not reached */
+	}
+	return (proc ? 0 : -1);
+}
+
+/**
+ * @brief
+ * Find a process, with workers, and get or set its priority.
+ *
+ * @param[in]
+ *       pid: Process ID.
+ *       prio: New priority, or -1 to leave it as is.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Priority of process, before any change
+ *       - Failure : -1, if there is no such process
+ */
+static int
+workerPrio(int pid, int prio)
+{
+	pcb_t	*proc;
+	int	old = -1;
+
+	pthread_mutex_lock(&procLock);
+	for (proc = procAll; proc; proc = proc->allNext) {
+		if (proc->pid == pid) {
+			old = proc->prio;
+			if (prio >= 0) {
+				proc->prio = prio;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&procLock);
+	return old;
+}
+
+/**
+ * @brief
+ * Free the workers and their deques. Threads of workers must have ended.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerRelease(void)
+{
+	dequeArray_t *a, *old;
+	worker_t *w;
+	int	i;
+
+	for (i = 0; i < workerCount; i++) {
+		w = workerTab[i];
+		if (w == NULL) {
+			continue;
+		}
+		for (a = w->q.array; a; a = old) {
+			old = a->old;
+			memFree(a);
+		}
+		memFree(w->idleStack);
+		memFree(w);
+	}
+	memFree(workerTab);
+	workerTab = NULL;
+	workerCount = workerThreads = 0;
+	return;
+}
+
+/**
+ * @brief
+ * Stop the workers, once the caller is the only process left, and go on
+ * with the caller on the thread that started them.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+workerEnd(void)
+{
+	pcb_t	*self = workerSelf()->running, *next;
+	worker_t *w;
+	int	i;
+
+	/* Help run the others meanwhile. */
+	while (__atomic_load_n(&procCount, __ATOMIC_ACQUIRE) > 1) {
+		w = self->worker;
+		next = workerPick(w, TRUE);
+		if (next) {
+			workerSwitch(w, self, next);
+		} else {
+			sched_yield();
+		}
+	}
+	__atomic_store_n(&workerStop, 1, __ATOMIC_RELEASE);
+	workerWakeUp(TRUE);
+
+	/* The idle loop of a worker other than 0 hands the caller over to
+	 * worker 0, and ends.
+	 */
+	if (self->worker != workerTab[0]) {
+		workerSwitch(self->worker, self, NULL);
+	}
+	for (i = 1; i < workerThreads; i++) {
+		pthread_join(workerTab[i]->tid, NULL);
+	}
+	if (workerPinned) {
+		pthread_setaffinity_np(pthread_self(), sizeof(workerCpus),
+				       &workerCpus);
+		workerPinned = FALSE;
+	}
+	workerRelease();
+	curWorker = NULL;
+	procAll = NULL;
+	procCount = 0;
+	procLive = 0;
+	runningProc = self;
+	return;
+}
+
+/**
+ * @brief
+ * Start workers. The caller, which must be the only process, becomes
+ * the running process of worker 0.
+ *
+ * @param[in]
+ *       n: Number of workers, 2 or more.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1
+ */
+static int
+workerBegin(int n)
+{
+	pcb_t	*self = runningProc;
+	worker_t *w;
+	cpu_set_t	one;
+	int	i, cpu;
+
+	workerTab = memAlloc(n * sizeof(worker_t *));
+	if (workerTab == NULL) {
+		return (-1);
+	}
+	memset(workerTab, 0, n * sizeof(worker_t *));
+	workerCount = n;
+	for (i = 0; i < n; i++) {
+		w = memAllocAligned(sizeof(worker_t), 64);
+		if (w == NULL) {
+			workerRelease();
+			return (-1);
+		}
+		memset(w, 0, sizeof(worker_t));
+		workerTab[i] = w;
+		w->id = i;
+		w->seed = (i + 1) * 2654435761U;
+		w->q.array = memAlloc(sizeof(dequeArray_t) +
+				      DEQ_INIT * sizeof(pcb_t *));
+		if (w->q.array == NULL) {
+			workerRelease();
+			return (-1);
+		}
+		w->q.array->old = NULL;
+		w->q.array->mask = DEQ_INIT - 1;
+	}
 
-static void sched(void);
+	/* The idle loop of worker 0 is entered by a switch, as is a new
+	 * process.
+	 */
+	w = workerTab[0];
+	w->idleStack = memAlloc(STACKSZ);
+	if (w->idleStack == NULL) {
+		workerRelease();
+		return (-1);
+	}
+	w->idleCtx.rsp = w->idleStack + STACKSZ - 16;
+	* (void **) w->idleCtx.rsp = (void *) workerIdle0;
+	w->idleCtx.mxcsr = MXCSR_INIT;
+	w->idleCtx.fpucw = FPUCW_INIT;
 
-int procId = 0;			/* Counter used to generate process identifer */
-/* TODO: We are using a PID generation that is too simplistic and will
- * wrap-over if too many processes are created. Need to replace with a
- * correct implementation.
- */
+	self->worker = w;
+	self->killed = FALSE;
+	self->allNext = self->allPrev = NULL;
+	procAll = self;
+	procCount = 1;
+	procLive = 1;
+	w->running = self;
+	curWorker = w;
+	workerStop = 0;
+	workerHandoff = NULL;
 
-pcb_t	*readyQ = NULL;		/* Queue of ready to run processes */
-pcb_t	*readyQEnd = NULL;	/* End of readyQ */
-pcb_t	*runningProc = NULL;	/* Process that is currently running */
+	workerThreads = 1;
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&workerTab[i]->tid, NULL, workerThread,
+				   workerTab[i]) != 0) {
+			workerEnd();
+			return (-1);
+		}
+		workerThreads++;
+	}
+
+	/* With a worker for each CPU, each keeps to its own; binding is
+	 * only a hint, so failure is of no account.
+	 */
+	if ((sched_getaffinity(0, sizeof(workerCpus), &workerCpus) == 0) &&
+	    (CPU_COUNT(&workerCpus) == n)) {
+		workerPinned = TRUE;
+		for (i = 0, cpu = 0; i < n; i++, cpu++) {
+			while (!CPU_ISSET(cpu, &workerCpus)) {
+				cpu++;
+			}
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			pthread_setaffinity_np(i ? workerTab[i]->tid :
+					       pthread_self(), sizeof(one),
+					       &one);
+		}
+	}
+	return 0;
+}
 
 /**
  * @brief
@@ -70,35 +1321,44 @@ void
 procInit(void)
 {
 	pcb_t	*proc;
-	char	*stack;
 
-	readyQ = NULL;
-	readyQEnd = NULL;
+	/* No ticks are taken until there is a process to switch from. */
+	preemptOff = 1;
+	preemptPending = FALSE;
+	memset(readyQ, 0, sizeof(readyQ));
+	readyMap = 0;
 	runningProc = NULL;
+	deadProc = NULL;
 	procId = 0;
 
+	/* PCBs come from their own cache, not the general allocator. */
+	pcbCache = slabCacheCreate(sizeof(pcb_t));
+	if (pcbCache == NULL) {
+		return;
+	}
+
 	/* Make the invoking code as the 'first' or 'init' process. */
-	proc = memAlloc(sizeof(pcb_t));
+	proc = slabAlloc(pcbCache);
 	if (proc == NULL) {
 		return;
 	}
 
-	__asm__("mov %%rsp, %0"
-		: "=r" (stack));
-
+	/* Its registers are saved by its first switch to another. */
 	proc->magic = MAGIC_PROC;
 	proc->pid = procId++;
 	proc->state = READY;
 	proc->stackAddr = NULL;
-	proc->stackPtr = stack;
+	proc->start = NULL;
+	proc->prio = PROC_PRIO_DEFAULT;
 
 	runningProc = proc;
+	PREEMPT_ON();
 	return;
 }
 
 /**
  * @brief
- * API to create a new process
+ * API to create a new process, of priority PROC_PRIO_DEFAULT.
  *
  * @param[in]
  *       start: Pointer to start address of code for new process.
@@ -112,39 +1372,75 @@ procInit(void)
  */
 int
 procCreate(procStart_t start)
+{
+	return procCreatePrio(start, PROC_PRIO_DEFAULT);
+}
+
+/**
+ * @brief
+ * API to create a new process of a given priority.
+ *
+ * @note
+ * The new process is put at the head of the ready queue of its
+ * priority, and the scheduler is run, so it runs at once unless a
+ * process of higher priority is ready. While workers run, only
+ * PROC_PRIO_DEFAULT is taken (see procSetWorkers()).
+ *
+ * @param[in]
+ *       start: Pointer to start address of code for new process.
+ *       prio: Priority, from 0 (highest) to PROC_PRIO_COUNT - 1.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Process ID of new process
+ *       - Failure : -1
+ */
+int
+procCreatePrio(procStart_t start, int prio)
 {
 	pcb_t	*proc;
 	char	*stack;
+	int	pid;
+
+	if ((prio < 0) || (prio >= PROC_PRIO_COUNT)) {
+		return (-1);
+	}
+	if (workerCount) {
+		/* Workers do not schedule by priority. */
+		if (prio != PROC_PRIO_DEFAULT) {
+			return (-1);
+		}
+		return workerCreate(start, prio);
+	}
 
-	proc = memAlloc(sizeof(pcb_t));
+	PREEMPT_OFF();
+	proc = slabAlloc(pcbCache);
 	if (proc == NULL) {
+		PREEMPT_ON();
 		return (-1);
 	}
 
 	stack = memAlloc(STACKSZ);
 	if (stack == NULL) {
-		memFree(proc);
+		slabFree(pcbCache, proc);
+		PREEMPT_ON();
 		return (-1);
 	}
 
 	proc->pid = procId++;
-	proc->state = READY;
-	proc->stackAddr = stack;
-	proc->stackPtr = stack + STACKSZ - sizeof(procStart_t);
-	* (procStart_t *) proc->stackPtr = start;
-	proc->stackPtr -= sizeof(void *);	/* Dummy EBP */
+	pcbInit(proc, stack, start, prio);
+	readyInsert(proc, TRUE);
 
-	/* Put process into ready list */
-	proc->next = readyQ;
-	readyQ = proc;
-	if (proc->next == NULL) {
-		readyQEnd = proc;
-	}
-
-	/* Run the scheduler */
+	/* Run the scheduler. The process may have run, and ended, by the
+	 * time this returns.
+	 */
+	pid = proc->pid;
 	sched();
+	PREEMPT_ON();
 
-	return (proc->pid);
+	return pid;
 }
 
 /**
@@ -158,40 +1454,40 @@ procCreate(procStart_t start)
  *       None.
  *
  * @return
- *       - Success : 0
- *       - Failure : -1
+ *       - Success : 0, or no return if the caller deletes itself
+ *       - Failure : -1, if the caller deletes itself and no other
+ *         process is left to run
  */
 int
 procDelete(int pid)
 {
 	pcb_t	*proc;
-	pcb_t	*prevProc;
 
-	/* Remove proc from readyQ */
-	proc = readyQ;
-	prevProc = NULL;
-	while (proc) {
-		if (proc->pid == pid) break;
-		prevProc = proc;
-		proc = proc->next;
+	if (workerCount) {
+		return workerDelete(pid);
 	}
-	if (proc) {
-		if (proc == readyQ) {
-			readyQ = proc->next;
-			if (readyQ == NULL) {
-				readyQEnd = NULL;
-			}
-		} else if (proc == readyQEnd) {
-			readyQEnd = prevProc;
-			prevProc->next = NULL;
-		} else {
-			prevProc->next = proc->next;
+	PREEMPT_OFF();
+	/* A process deleting itself is the common case; its stack is in
+	 * use until the switch away from it, so it is freed after that.
+	 */
+	if (runningProc && (runningProc->pid == pid)) {
+		if (readyMap == 0) {
+			/* None would be left to run. */
+			PREEMPT_ON();
+			return (-1);
 		}
+		deadProc = runningProc;
+		runningProc = NULL;
+		sched();
+		return 0;
+	}
+
+	proc = readyFind(pid);
+	if (proc) {
+		readyRemove(proc);
 		/* Free the memory allocated for process management */
 		memFree(proc->stackAddr);
-		memFree(proc);
-	} else if (runningProc->pid == pid) {
-		runningProc = NULL;
+		slabFree(pcbCache, proc);
 	} else {
 		/* Must not happen !! */
 		/* When we implement more states, then we need
@@ -199,6 +1495,7 @@ procDelete(int pid)
 		 */
 	}
 	sched();
+	PREEMPT_ON();
 	return 0;
 }
 
@@ -218,69 +1515,390 @@ procDelete(int pid)
 void
 procYield(void)
 {
+	if (workerCount) {
+		workerYield();
+		return;
+	}
+	PREEMPT_OFF();
+	sched();
+	PREEMPT_ON();
+}
+
+/**
+ * @brief
+ * API to change the priority of a process.
+ *
+ * @note
+ * A ready process goes to the end of the ready queue of its new
+ * priority. If a ready process now has a higher priority than the
+ * running one, it is switched to.
+ *
+ * @param[in]
+ *       pid: Process ID.
+ *       prio: Priority, from 0 (highest) to PROC_PRIO_COUNT - 1.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1, if priority is out of range, or is not
+ *         PROC_PRIO_DEFAULT while workers run, or there is no such
+ *         process
+ */
+int
+procSetPrio(int pid, int prio)
+{
+	pcb_t	*proc;
+
+	if ((prio < 0) || (prio >= PROC_PRIO_COUNT)) {
+		return (-1);
+	}
+	if (workerCount) {
+		/* Workers do not schedule by priority. */
+		if (prio != PROC_PRIO_DEFAULT) {
+			return (-1);
+		}
+		return ((workerPrio(pid, prio) < 0) ? -1 : 0);
+	}
+	PREEMPT_OFF();
+	if (runningProc && (runningProc->pid == pid)) {
+		runningProc->prio = prio;
+	} else if ((proc = readyFind(pid)) != NULL) {
+		readyRemove(proc);
+		proc->prio = prio;
+		readyInsert(proc, FALSE);
+	} else {
+		PREEMPT_ON();
+		return (-1);
+	}
+
+	if (readyMap && runningProc &&
+	    (__builtin_ctz(readyMap) < runningProc->prio)) {
+		sched();
+	}
+	PREEMPT_ON();
+	return 0;
+}
+
+/**
+ * @brief
+ * API to get the priority of a process.
+ *
+ * @param[in]
+ *       pid: Process ID.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Priority of process
+ *       - Failure : -1, if there is no such process
+ */
+int
+procGetPrio(int pid)
+{
+	pcb_t	*proc;
+	int	prio;
+
+	if (workerCount) {
+		return workerPrio(pid, -1);
+	}
+	PREEMPT_OFF();
+	if (runningProc && (runningProc->pid == pid)) {
+		prio = runningProc->prio;
+	} else {
+		proc = readyFind(pid);
+		prio = proc ? proc->prio : -1;
+	}
+	PREEMPT_ON();
+	return prio;
+}
+
+/**
+ * @brief
+ * API to start a section of the running process that must not be
+ * preempted. Sections nest, and are ended by procPreemptEnable().
+ *
+ * @note
+ * All processes run on one thread, so code that is not reentrant, or
+ * that takes a lock, must not be preempted by another process that may
+ * run the same code. memAlloc()/memFree() and stdio are such code: when
+ * a quantum is set, processes must call them within a section.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+procPreemptDisable(void)
+{
+	PREEMPT_OFF();
+}
+
+/**
+ * @brief
+ * API to end a section started by procPreemptDisable(). Ending the
+ * outermost section takes a tick that came during it, if any.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+procPreemptEnable(void)
+{
+	PREEMPT_ON();
+}
+
+/**
+ * @brief
+ * Take a tick that came during a section not to be preempted, at the
+ * end of the section.
+ *
+ * @param[in]
+ *       None.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+preemptTake(void)
+{
+	preemptPending = FALSE;
+	PREEMPT_OFF();
+	sched();
+	preemptOff--;
+}
+
+/**
+ * @brief
+ * Handler of the timer signal. Preempts the running process, unless it
+ * is in a section that must not be preempted, by running the scheduler
+ * from the signal handler. The interrupted registers stay in the signal
+ * frame on the stack of the process, and are loaded back once the
+ * process is switched back to and the handler returns.
+ *
+ * @param[in]
+ *       sig: Signal number.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+static void
+preemptTick(int sig)
+{
+	sigset_t set;
+	int	err;
+
+	if (preemptOff) {
+		preemptPending = TRUE;
+		return;
+	}
+	err = errno;
+	preemptOff = 1;
+	preemptPending = FALSE;
+
+	/* The signal is blocked while its handler runs. Unblock it, as the
+	 * process switched to may not return through this handler. The
+	 * mask of this process is set back by the return from the handler.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
 	sched();
+
+	preemptOff = 0;
+	errno = err;
+	return;
+}
+
+/**
+ * @brief
+ * API to set the time slice of processes. A periodic timer then makes
+ * the running process give way to the next ready process of the same or
+ * a higher priority, as if it called procYield(), so a process that does
+ * not yield no longer keeps others of its priority from running.
+ *
+ * @note
+ * The timer is ITIMER_REAL, so SIGALRM is taken over while a quantum is
+ * set. It ticks at a fixed period, so a process that is switched to in
+ * the middle of a period gets less than a full quantum.
+ *
+ * @note
+ * A tick may come while a process is inside memAlloc()/memFree() or
+ * stdio, which hold locks that are not recursive; the process switched
+ * to deadlocks if it takes the same lock. So every process must call
+ * them within procPreemptDisable()/procPreemptEnable() while a quantum
+ * is set. A quantum is refused before procInit(), or when the running
+ * process ended more sections than it started, as no section would then
+ * hold off the timer.
+ *
+ * @param[in]
+ *       usec: Quantum in microseconds, 0 to turn preemption off.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1
+ */
+int
+procSetQuantum(int usec)
+{
+	struct sigaction sa;
+	struct itimerval it;
+
+	if ((usec < 0) || (usec && workerCount)) {
+		return (-1);
+	}
+	if (usec && ((runningProc == NULL) || (preemptOff < 0))) {
+		return (-1);
+	}
+	if (usec) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = preemptTick;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGALRM, &sa, NULL) < 0) {
+			return (-1);
+		}
+	}
+	/* The handler is left in place when turned off, for a tick that
+	 * may be on its way.
+	 */
+	it.it_interval.tv_sec = usec / 1000000;
+	it.it_interval.tv_usec = usec % 1000000;
+	it.it_value = it.it_interval;
+	if (setitimer(ITIMER_REAL, &it, NULL) < 0) {
+		return (-1);
+	}
+	preemptQuantum = usec;
+	return 0;
+}
+
+/**
+ * @brief
+ * API to set the number of threads, the workers, that run processes.
+ * With one worker, the default, processes run on the thread of
+ * procInit(), as set out above. With more, each worker has a deque of
+ * ready processes of its own, and a worker whose deque is empty takes
+ * processes from the deques of others, so processes spread over the
+ * cores. procCreate(), procYield() and procDelete() may then be called
+ * on any worker.
+ *
+ * @note
+ * Workers take turns among the processes they hold without regard to
+ * priority, so procCreatePrio() and procSetPrio() refuse any priority
+ * but PROC_PRIO_DEFAULT meanwhile; there is no preemption either (see
+ * procSetQuantum()). A
+ * process created runs at once on the worker of its creator, which is
+ * queued there. Deleting another process marks it; it is freed at its
+ * next switch. Processes must treat memory they share as threads do.
+ * A worker with nothing to run sleeps until a process is queued. With
+ * as many workers as the caller has CPUs, each is bound to a CPU.
+ *
+ * @param[in]
+ *       n: Number of workers, 1 or more. Workers are started only by
+ *          the only process there is; going back to one worker waits
+ *          until the caller is the only process left.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1
+ */
+int
+procSetWorkers(int n)
+{
+	if (n < 1) {
+		return (-1);
+	}
+	if (workerCount) {
+		workerEnd();
+	}
+	if (n == 1) {
+		return 0;
+	}
+	if ((runningProc == NULL) || readyMap || preemptQuantum) {
+		return (-1);
+	}
+	return workerBegin(n);
 }
 
 /**
  * @brief
- * The scheduler.
+ * The scheduler. Switches to the process at the head of the highest
+ * priority ready queue, putting the running process at the end of the
+ * queue of its priority. A running process gives way only to a process
+ * of the same or a higher priority, so processes of one priority take
+ * turns, and run only when none of a higher priority is ready.
+ *
+ * @note
+ * Called with preemption off.
  *
  * @param[in]
- *       iparam: Description of iparam
+ *       None.
  *
  * @param[out]
- *       oparam: Description of oparam
+ *       None.
  *
  * @return
- *       - Success return value
- *       - Failure return value
+ *       - None, once the running process is switched back to.
  */
 static void
 sched(void)
 {
 	pcb_t	*proc, *oldProc;
-	void	*oldStackPtr, *newStackPtr;
+	int	prio, depth;
 
-	proc = readyQ;
-	if (proc == NULL) {
+	if (readyMap == 0) {
 		/* Nothing to schedule. Continue with current process. */
 		return;
 	}
+	prio = __builtin_ctz(readyMap);
 
 	oldProc = runningProc;
+	if (oldProc && (prio > oldProc->prio)) {
+		/* Only lower priority processes are ready. */
+		return;
+	}
 
-	/* Dequeue process from readyQ */
-	readyQ = proc->next;
-	if (readyQ == NULL) readyQEnd = NULL;
+	/* Dequeue process from its ready queue */
+	proc = readyQ[prio].head;
+	readyRemove(proc);
 
-	/* Put current running proc into readyQ */
-	if (readyQ == NULL) {
-		readyQ = readyQEnd = runningProc;
-	} else {
-		readyQEnd->next = runningProc;
-		readyQEnd = runningProc;
+	/* Put current running proc into readyQ, unless it is deleted */
+	if (oldProc) {
+		readyInsert(oldProc, FALSE);
 	}
 
-	newStackPtr = proc->stackPtr;
 	runningProc = proc;
 	runningProc->next = NULL;
 
-	/* Switch stack-pointer to stack of newly running process */
-	// Tricky business. Do the following:
-	// Old-Proc:
-	// 	stackPtr = Register-RSP; (64-bit)
-	//
-	__asm__ ("mov %%rsp, %0"
-		 : "=r" (oldStackPtr));
-	// New-Proc:
-	//	Register-RSP = stackPtr; (64-bit)
-	//	return;			/* This would do "pop ebp; ret" */
-	__asm__ ("mov %0, %%rsp"
-		 :
-		 : "r" (newStackPtr));
-	if (oldProc) {
-		oldProc->stackPtr = oldStackPtr;
-	}
-
+	/* Sections not to be preempted belong to the process they are in. */
+	depth = preemptOff;
+	ctxSwitch(oldProc ? &oldProc->ctx : &deadCtx, &proc->ctx);
+	preemptOff = depth;
+	procReap();
 	return;
 }
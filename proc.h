@@ -12,12 +12,32 @@
 #ifndef _PROC_H_
 #define _PROC_H_
 
+/* Priorities, from 0 (highest) to PROC_PRIO_COUNT - 1 (lowest). A ready
+ * process runs only when no process of a higher priority is ready.
+ * Workers (procSetWorkers() with more than one) ignore priorities, so
+ * procCreatePrio() and procSetPrio() then take only PROC_PRIO_DEFAULT.
+ */
+#define PROC_PRIO_COUNT		32
+#define PROC_PRIO_DEFAULT	16	/* Priority given by procCreate() */
+
 /* Process start function template */
 typedef int (*procStart_t) (void);
 
 extern void procInit(void);
 extern int procCreate(procStart_t start);
+extern int procCreatePrio(procStart_t start, int prio);
 extern int procDelete(int pid);
 extern void procYield(void);
+extern int procSetPrio(int pid, int prio);
+extern int procGetPrio(int pid);
+extern void procPreemptDisable(void);
+extern void procPreemptEnable(void);
+/* While a quantum is set, processes must call memAlloc()/memFree() and
+ * stdio between procPreemptDisable() and procPreemptEnable(). A tick
+ * taken inside them switches to a process that may wait forever on a
+ * lock the preempted one holds.
+ */
+extern int procSetQuantum(int usec);
+extern int procSetWorkers(int n);
 
 #endif /* _PROC_H_ */
@@ -0,0 +1,501 @@
+/**
+ * @file      procbench.c
+ * @brief     Benchmarks for toy kernel process management.
+ *
+ * Run as "procbench [name]" to run one benchmark, or with no argument
+ * to run all of them. Times are in nanoseconds, and in TSC cycles as
+ * read by rdtsc.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <mem.h>
+#include <proc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REGION_SIZE	(1L*1024*1024*1024)	/* Largest region of heap */
+#define RING_MAX	100000	/* Most processes in a ring */
+#define RING_SWITCHES	2000000	/* Switches timed per ring size */
+#define CREATE_CYCLES	200000	/* Create/delete cycles timed */
+#define LAT_HOGS	4	/* CPU bound processes */
+#define LAT_SLICE	5000000	/* ns a hog runs between yields */
+#define LAT_RUN		1000000000 /* ns each quantum is measured for */
+#define LAT_SPIN	250000000 /* ns a hog that never yields runs for */
+#define LAT_SAMPLES	1000000	/* Most latencies recorded */
+#define SCALE_PROCS	256	/* Processes spread over the workers */
+#define SCALE_YIELDS	2000	/* Yields of each process */
+#define SCALE_WORK	1000	/* Work between yields, in xorshift steps */
+
+/**
+ * @brief
+ * Get a monotonic time stamp.
+ *
+ * @return
+ *       - Time in nanoseconds.
+ */
+static uint64_t
+nsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ * @brief
+ * Set up the default heap, big enough for the stacks of 'procs'
+ * processes, and the process management.
+ *
+ * @note
+ * The memory is reserved, not committed, so only the pages processes
+ * touch are backed. Regions are at most REGION_SIZE, as their size is an
+ * int.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1
+ */
+static int
+setup(int procs)
+{
+	static char	*heap;
+	static long	heapLen;
+	long	len, off, n;
+
+	len = (procs + 16) * (long) (256 * 1024);
+	if (len > heapLen) {
+		if (heap) {
+			munmap(heap, heapLen);
+		}
+		heap = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			    -1, 0);
+		if (heap == MAP_FAILED) {
+			heap = NULL;
+			heapLen = 0;
+			return (-1);
+		}
+		heapLen = len;
+	}
+
+	for (off = 0; off < heapLen; off += n) {
+		n = (heapLen - off < REGION_SIZE) ? heapLen - off : REGION_SIZE;
+		if (off == 0) {
+			memInit(heap, n);
+		} else if (memAddRegion(heap + off, n) < 0) {
+			return (-1);
+		}
+	}
+	procInit();
+	return 0;
+}
+
+int	ringSize;		/* Processes in ring, including "init" */
+int	ringMade;		/* Workers started */
+int	ringLive;		/* Workers not done yet */
+int	ringStop;		/* Set to let workers finish */
+
+/**
+ * @brief
+ * Worker of a ring. Creates the next worker, so that setting up a ring
+ * takes one switch per worker, and yields until told to stop.
+ */
+static int
+ringProc(void)
+{
+	if (++ringMade < ringSize - 1) {
+		procCreate(ringProc);
+	}
+	while (!ringStop) {
+		procYield();
+	}
+	ringLive--;
+	return 0;
+}
+
+/**
+ * @brief
+ * Cost of procYield() with ready queues of 2 to RING_MAX processes, each
+ * yielding in turn.
+ */
+static void
+benchYield(void)
+{
+	uint64_t t, c;
+	long	switches;
+	int	rounds, i;
+
+	printf("yield: ring of processes, %d switches timed\n", RING_SWITCHES);
+	printf("%8s %12s %12s %14s\n", "procs", "ns/switch", "Mswitch/s",
+	       "cycles/switch");
+	for (ringSize = 2; ringSize <= RING_MAX; ringSize *= 10) {
+		if (setup(ringSize) < 0) {
+			printf("%8d %12s\n", ringSize, "no memory");
+			break;
+		}
+		ringMade = ringStop = 0;
+		ringLive = ringSize - 1;
+		if (procCreate(ringProc) < 0) {
+			printf("%8d %12s\n", ringSize, "no memory");
+			break;
+		}
+		if (ringMade != ringSize - 1) {
+			printf("%8d %12s\n", ringSize, "no memory");
+			break;
+		}
+
+		/* Each round is one yield of every process in the ring. */
+		rounds = (RING_SWITCHES + ringSize - 1) / ringSize;
+		switches = (long) rounds * ringSize;
+		t = nsNow();
+		c = __builtin_ia32_rdtsc();
+		for (i = 0; i < rounds; i++) {
+			procYield();
+		}
+		c = __builtin_ia32_rdtsc() - c;
+		t = nsNow() - t;
+		printf("%8d %12.1f %12.2f %14.1f\n", ringSize,
+		       (double) t / switches, switches * 1000.0 / t,
+		       (double) c / switches);
+
+		ringStop = 1;
+		while (ringLive) {
+			procYield();
+		}
+		if (ringSize == 2) {
+			ringSize = 1;	/* Go on with 10, 100, ... */
+		}
+	}
+	return;
+}
+
+/**
+ * @brief
+ * Process that ends at once.
+ */
+static int
+nullProc(void)
+{
+	return 0;
+}
+
+/**
+ * @brief
+ * Cost of a process life cycle: procCreate() of a process, which runs
+ * at once and ends, deleting itself, after which its creator runs again.
+ * That is two switches, besides the creation and deletion.
+ */
+static void
+benchCreate(void)
+{
+	uint64_t t, c;
+	int	i;
+
+	printf("create: procCreate() of a process that ends at once, "
+	       "%d times\n", CREATE_CYCLES);
+	printf("%12s %12s %14s\n", "ns/cycle", "Kcycle/s", "tsc/cycle");
+	if (setup(16) < 0) {
+		printf("%12s\n", "no memory");
+		return;
+	}
+	t = nsNow();
+	c = __builtin_ia32_rdtsc();
+	for (i = 0; i < CREATE_CYCLES; i++) {
+		if (procCreate(nullProc) < 0) {
+			printf("%12s\n", "no memory");
+			return;
+		}
+	}
+	c = __builtin_ia32_rdtsc() - c;
+	t = nsNow() - t;
+	printf("%12.1f %12.1f %14.1f\n", (double) t / CREATE_CYCLES,
+	       CREATE_CYCLES * 1000000.0 / t, (double) c / CREATE_CYCLES);
+	return;
+}
+
+uint64_t latGap[LAT_SAMPLES];	/* Latencies of the interactive process */
+int	latCount;		/* Latencies recorded */
+int	latStop;		/* Set to let hogs finish */
+int	latLive;		/* Processes not done yet */
+
+/**
+ * @brief
+ * CPU bound process. Yields only after it has run for LAT_SLICE, as a
+ * batch job that seldom blocks would.
+ */
+static int
+hogProc(void)
+{
+	uint64_t t;
+
+	while (!latStop) {
+		t = nsNow();
+		while (!latStop && (nsNow() - t < LAT_SLICE));
+		procYield();
+	}
+	procPreemptDisable();
+	latLive--;
+	procPreemptEnable();
+	return 0;
+}
+
+/**
+ * @brief
+ * CPU bound process that never yields. Runs for LAT_SPIN, then lets the
+ * interactive process finish.
+ */
+static int
+spinProc(void)
+{
+	uint64_t end = nsNow() + LAT_SPIN;
+
+	while (nsNow() < end);
+	latStop = 1;
+	procPreemptDisable();
+	latLive--;
+	procPreemptEnable();
+	return 0;
+}
+
+/**
+ * @brief
+ * Interactive process. Yields as soon as it runs, recording how long it
+ * waited to run again.
+ */
+static int
+interProc(void)
+{
+	uint64_t t, last, end;
+
+	last = nsNow();
+	end = last + LAT_RUN;
+	while (!latStop && (last < end) && (latCount < LAT_SAMPLES)) {
+		procYield();
+		t = nsNow();
+		latGap[latCount++] = t - last;
+		last = t;
+	}
+	latStop = 1;
+	procPreemptDisable();
+	latLive--;
+	procPreemptEnable();
+	return 0;
+}
+
+/**
+ * @brief
+ * Order latencies for qsort().
+ */
+static int
+latCmp(const void *a, const void *b)
+{
+	uint64_t x = * (const uint64_t *) a, y = * (const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief
+ * Run an interactive process with 'hogs' CPU bound processes at a time
+ * slice, and print the latencies of the interactive process.
+ */
+static void
+latRun(int quantum, int hogs, procStart_t hog)
+{
+	int	i;
+
+	if (setup(hogs + 1) < 0) {
+		printf("%12d %10s\n", quantum, "no memory");
+		return;
+	}
+	latCount = latStop = 0;
+	latLive = hogs + 1;
+	if (procSetQuantum(quantum) < 0) {
+		printf("%12d %10s\n", quantum, "no timer");
+		return;
+	}
+	/* The interactive process is there before the hogs get going. */
+	procCreate(interProc);
+	for (i = 0; i < hogs; i++) {
+		procCreate(hog);
+	}
+	while (latLive) {
+		procYield();
+	}
+	procSetQuantum(0);
+
+	if (quantum) {
+		printf("%12d", quantum);
+	} else {
+		printf("%12s", "off");
+	}
+	if (latCount == 0) {
+		printf(" %10d\n", 0);
+		return;
+	}
+	qsort(latGap, latCount, sizeof(latGap[0]), latCmp);
+	printf(" %10d %10.1f %10.1f %10.1f\n", latCount,
+	       latGap[latCount / 2] / 1000.0,
+	       latGap[(long) latCount * 99 / 100] / 1000.0,
+	       latGap[latCount - 1] / 1000.0);
+	return;
+}
+
+/**
+ * @brief
+ * Latency of an interactive process that shares its priority with CPU
+ * bound processes, without preemption and with time slices of a few
+ * sizes. Latency is the time from a yield of the interactive process
+ * until it runs again. Hogs that yield now and then only delay it; one
+ * that never yields starves it, unless there is preemption.
+ */
+static void
+benchPreempt(void)
+{
+	static const int quantum[] = { 0, 1000, 100 };
+	int	q;
+
+	printf("preempt: 1 interactive process and %d hogs that yield every "
+	       "%d ms\n", LAT_HOGS, LAT_SLICE / 1000000);
+	printf("%12s %10s %10s %10s %10s\n", "quantum us", "samples",
+	       "p50 us", "p99 us", "max us");
+	for (q = 0; q < sizeof(quantum) / sizeof(quantum[0]); q++) {
+		latRun(quantum[q], LAT_HOGS, hogProc);
+	}
+
+	printf("preempt: 1 interactive process and 1 hog that never yields, "
+	       "for %d ms\n", LAT_SPIN / 1000000);
+	printf("%12s %10s %10s %10s %10s\n", "quantum us", "samples",
+	       "p50 us", "p99 us", "max us");
+	for (q = 0; q < sizeof(quantum) / sizeof(quantum[0]); q++) {
+		latRun(quantum[q], 1, spinProc);
+	}
+	return;
+}
+
+int	scaleLive;		/* Processes not done yet */
+uint32_t scaleSink;		/* Keeps the work from being optimized out */
+
+/**
+ * @brief
+ * Process of "workers" benchmark. Computes for a while, and yields,
+ * SCALE_YIELDS times.
+ */
+static int
+scaleProc(void)
+{
+	uint32_t x = 1;
+	int	i, j;
+
+	for (i = 0; i < SCALE_YIELDS; i++) {
+		for (j = 0; j < SCALE_WORK; j++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+		procYield();
+	}
+	__atomic_add_fetch(&scaleSink, x, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&scaleLive, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * @brief
+ * Scaling of processes that compute and yield with the number of
+ * workers, from 1, which is the scheduler without workers, to the number
+ * of cores. The processes are all created on worker 0, so others get
+ * work only by stealing it.
+ */
+static void
+benchWorkers(void)
+{
+	uint64_t t, t1 = 0;
+	long	ncpu;
+	int	n, i;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	printf("workers: %d processes, %d yields each, %d steps of work "
+	       "between\n", SCALE_PROCS, SCALE_YIELDS, SCALE_WORK);
+	printf("%8s %10s %12s %10s\n", "workers", "ms", "Kyield/s",
+	       "speedup");
+	for (n = 1; n <= ncpu; n = (n < ncpu && n * 2 > ncpu) ? ncpu : n * 2) {
+		if (setup(SCALE_PROCS) < 0) {
+			printf("%8d %10s\n", n, "no memory");
+			return;
+		}
+		if (procSetWorkers(n) < 0) {
+			printf("%8d %10s\n", n, "no workers");
+			return;
+		}
+		scaleLive = SCALE_PROCS;
+		t = nsNow();
+		for (i = 0; i < SCALE_PROCS; i++) {
+			if (procCreate(scaleProc) < 0) {
+				scaleLive -= SCALE_PROCS - i;
+				break;
+			}
+		}
+		/* Going back to one worker waits for the processes. */
+		procSetWorkers(1);
+		while (__atomic_load_n(&scaleLive, __ATOMIC_ACQUIRE)) {
+			procYield();
+		}
+		t = nsNow() - t;
+		if (i < SCALE_PROCS) {
+			printf("%8d %10s\n", n, "no memory");
+			return;
+		}
+		if (n == 1) {
+			t1 = t;
+		}
+		printf("%8d %10.1f %12.1f %10.2f\n", n, t / 1e6,
+		       (double) SCALE_PROCS * SCALE_YIELDS * 1e6 / t,
+		       (double) t1 / t);
+		if (n == ncpu) {
+			break;
+		}
+	}
+	return;
+}
+
+/* Table of benchmarks */
+static struct {
+	const char	*name;
+	void	(*fn)(void);
+} benches[] = {
+	{ "yield",	benchYield },
+	{ "create",	benchCreate },
+	{ "preempt",	benchPreempt },
+	{ "workers",	benchWorkers },
+};
+
+int
+main(int argc, char *argv[])
+{
+	int	i, found = 0;
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if ((argc < 2) || (strcmp(argv[1], benches[i].name) == 0)) {
+			benches[i].fn();
+			found = 1;
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "usage: %s [", argv[0]);
+		for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+			fprintf(stderr, "%s%s", i ? "|" : "", benches[i].name);
+		}
+		fprintf(stderr, "]\n");
+		return 1;
+	}
+	return 0;
+}
@@ -10,9 +10,237 @@
 
 #include <mem.h>
 #include <proc.h>
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
-char space[1*1024*1024];
+char space[8*1024*1024];
+
+char runLog[64];		/* Order in which test processes ran */
+int runLen;
+
+void
+logRun (char c)
+{
+	runLog[runLen++] = c;
+	runLog[runLen] = 0;
+}
+
+int
+procA (void)
+{
+	logRun('a');
+	return 0;
+}
+
+int
+procB (void)
+{
+	logRun('b');
+	return 0;
+}
+
+void
+rrLoop (char c)
+{
+	int i;
+
+	for (i=0; i<3; i++) {
+		logRun(c);
+		procYield();
+	}
+}
+
+int
+procX (void)
+{
+	rrLoop('x');
+	return 0;
+}
+
+int
+procY (void)
+{
+	rrLoop('y');
+	return 0;
+}
+
+int
+procZ (void)
+{
+	rrLoop('z');
+	return 0;
+}
+
+/* Priorities: a process of higher priority runs first, one that comes to
+ * outrank the running process runs at once, and processes of a priority
+ * take turns.
+ */
+void
+testPrio (void)
+{
+	assert(procGetPrio(0) == PROC_PRIO_DEFAULT);
+	assert(procCreatePrio(procA, -1) == -1);
+	assert(procCreatePrio(procA, PROC_PRIO_COUNT) == -1);
+	assert(procSetPrio(0, PROC_PRIO_COUNT) == -1);
+	assert(procSetPrio(12345, 1) == -1);
+	assert(procGetPrio(12345) == -1);
+
+	runLen = 0;
+	runLog[0] = 0;
+	procCreatePrio(procA, PROC_PRIO_DEFAULT + 4);
+	assert(strcmp(runLog, "") == 0); // Lower, waits.
+	procYield();
+	assert(strcmp(runLog, "") == 0);
+	procCreatePrio(procB, PROC_PRIO_DEFAULT - 4);
+	assert(strcmp(runLog, "b") == 0); // Higher, runs at once.
+	procSetPrio(0, PROC_PRIO_DEFAULT + 8);
+	assert(strcmp(runLog, "ba") == 0); // Now outranks init.
+	procSetPrio(0, PROC_PRIO_DEFAULT);
+
+	/* Created under a higher priority init, each at the head of the
+	 * queue, and run in turn once init drops below them.
+	 */
+	runLen = 0;
+	runLog[0] = 0;
+	procSetPrio(0, PROC_PRIO_DEFAULT - 1);
+	procCreate(procX);
+	procCreate(procY);
+	procCreate(procZ);
+	assert(strcmp(runLog, "") == 0);
+	procSetPrio(0, PROC_PRIO_DEFAULT + 1);
+	assert(strcmp(runLog, "zyxzyxzyx") == 0);
+	procSetPrio(0, PROC_PRIO_DEFAULT);
+	procYield();
+	assert(procDelete(0) == -1); // All others ended.
+}
+
+int
+procP (void)
+{
+	procYield();
+	logRun('p');
+	return 0;
+}
+
+/* Preemption: a tick arriving while preemption is disabled is held
+ * until the outermost enable, which then switches at once.
+ */
+void
+testPreempt (void)
+{
+	struct timespec start, now;
+
+	runLen = 0;
+	runLog[0] = 0;
+	procCreate(procP);		// Runs up to its yield.
+	procPreemptDisable();
+	assert(procSetQuantum(1000) == 0);
+	procPreemptDisable();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000000L +
+		 (now.tv_nsec - start.tv_nsec) < 20000000L);
+	assert(strcmp(runLog, "") == 0); // Ticks were held.
+	procPreemptEnable();
+	assert(strcmp(runLog, "") == 0); // Still nested.
+	procPreemptEnable();
+	assert(strcmp(runLog, "p") == 0); // Taken here.
+	procSetQuantum(0);
+
+	/* An enable without its disable leaves nothing to hold off ticks. */
+	procPreemptEnable();
+	assert(procSetQuantum(1000) == -1);
+	procPreemptDisable();
+}
+
+int wDone;			/* Worker test processes that ended */
+int wNext;
+int wVictim[4];
+
+int
+wSleeper (void)
+{
+	for (;;) {
+		procYield();
+	}
+	return 0;
+}
+
+int
+wChild (void)
+{
+	int i;
+
+	for (i=0; i<20; i++) {
+		procYield();
+	}
+	__atomic_add_fetch(&wDone, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int
+wKiller (void)
+{
+	int i;
+
+	for (i=0; i<4; i++) {
+		procCreate(wChild);
+		procYield();
+	}
+	i = __atomic_fetch_add(&wNext, 1, __ATOMIC_RELAXED);
+	assert(procDelete(wVictim[i]) == 0);
+	__atomic_add_fetch(&wDone, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Workers: processes created, yielding and deleting one another on a few
+ * workers all end, and all their memory is freed, once back on one.
+ */
+void
+testWorkers (void)
+{
+	memStats_t before, after;
+	int i, n;
+
+	/* Blocks cached by the threads of workers would hide leaks. */
+	memTcacheFlush();
+	memTcacheEnable(0);
+	memStats(&before);
+	for (n=2; n<=4; n++) {
+		wDone = wNext = 0;
+		assert(procSetWorkers(n) == 0);
+		for (i=0; i<4; i++) {
+			wVictim[i] = procCreate(wSleeper);
+		}
+		for (i=0; i<4; i++) {
+			procCreate(wKiller);
+		}
+		assert(procSetWorkers(1) == 0);
+		assert(wDone == 4*4 + 4);
+		for (i=0; i<4; i++) {
+			assert(procGetPrio(wVictim[i]) == -1); // Freed.
+		}
+	}
+
+	/* Workers ignore priorities, and a process deleted but not yet
+	 * freed leaves the caller the last one.
+	 */
+	assert(procSetWorkers(2) == 0);
+	assert(procCreatePrio(wChild, 0) == -1);
+	i = procCreate(wSleeper);
+	assert(procSetPrio(i, 0) == -1);
+	assert(procSetPrio(i, PROC_PRIO_DEFAULT) == 0);
+	assert(procDelete(i) == 0);
+	assert(procDelete(0) == -1);
+	assert(procSetWorkers(1) == 0);
+	memStats(&after);
+	memTcacheEnable(1);
+	assert(after.usedBlocks == before.usedBlocks); // PCBs and stacks
+	assert(after.usedBytes == before.usedBytes);
+}
 
 int p1Pid, p2Pid;
 
@@ -68,7 +296,12 @@ main(void)
 {
 	memInit(space, sizeof(space));
 
+	assert(procSetQuantum(1000) == -1); // No process to preempt yet.
 	procInit();
+	assert(procDelete(0) == -1); // The last process stays.
+	testPrio();
+	testPreempt();
+	testWorkers();
 	p1Pid = procCreate(process1);
 	for(;;) {
 		/* TODO: We need to implement waiting for process
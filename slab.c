@@ -0,0 +1,387 @@
+/**
+ * @file      slab.c
+ * @brief     Slab allocator for toy kernel.
+ *
+ * Caches of fixed-size objects. Memory for a cache is obtained from the
+ * general purpose allocator as page sized and aligned slabs (see
+ * memAllocAligned()). Objects are handed out of, and returned to, the
+ * intrusive free list of their slab, so they carry no per-object header
+ * and do not go through the freelist management of mem.c.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <slab.h>
+#include <mem.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef UNIT_TEST
+#include <assert.h>
+#endif /* UNIT_TEST */
+
+#define SLAB_SIZE	4096		/* Size (and alignment) of a slab */
+/* Magic# to recognize a slab in the memory. */
+#define MAGIC_SLAB	0x534C4142	/* 'SLAB' */
+
+/* Slab header. Kept at start of the slab, objects follow it. */
+typedef struct slab_ {
+	struct slab_	*next;	/* Next slab in partial/full list */
+	struct slab_	*prev;	/* Previous slab in partial/full list */
+	slabCache_t	*cache;	/* Cache this slab belongs to */
+	void	*freeObj;	/* Intrusive list of free objects */
+	uint32_t	magic;	/* Magic# for slab */
+	int	inUse;		/* Number of objects allocated */
+} slab_t;
+
+/* Slab cache */
+struct slabCache_ {
+	int	objSize;	/* Size of each object */
+	int	objsPerSlab;	/* Number of objects in a slab */
+	slab_t	*partial;	/* Slabs with at least one free object */
+	slab_t	*full;		/* Slabs with no free object */
+};
+
+/**
+ * @brief
+ * Get the slab that an object belongs to.
+ *
+ * @param[in]
+ *       obj: Address of object.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Pointer to slab header.
+ */
+static slab_t *
+slabOf(void *obj)
+{
+	return (slab_t *) ((uintptr_t) obj & ~((uintptr_t) SLAB_SIZE - 1));
+}
+
+/**
+ * @brief
+ * Push a slab at the head of a slab list.
+ *
+ * @param[in]
+ *       list: Head of slab list.
+ *       s: Slab to be inserted.
+ *
+ * @param[out]
+ *       list: Updated head of slab list.
+ *
+ * @return
+ *       - None.
+ */
+static void
+slabListInsert(slab_t **list, slab_t *s)
+{
+	s->prev = NULL;
+	s->next = *list;
+	if (*list) {
+		(*list)->prev = s;
+	}
+	*list = s;
+	return;
+}
+
+/**
+ * @brief
+ * Remove a slab from a slab list.
+ *
+ * @param[in]
+ *       list: Head of slab list.
+ *       s: Slab to be removed.
+ *
+ * @param[out]
+ *       list: Updated head of slab list.
+ *
+ * @return
+ *       - None.
+ */
+static void
+slabListRemove(slab_t **list, slab_t *s)
+{
+	if (s->next) {
+		s->next->prev = s->prev;
+	}
+	if (s->prev) {
+		s->prev->next = s->next;
+	} else {
+		*list = s->next;
+	}
+	s->next = s->prev = NULL;
+	return;
+}
+
+/**
+ * @brief
+ * Get a slab from memory management and add it to a cache.
+ *
+ * @param[in]
+ *       cache: Cache to which new slab is to be added.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : 0
+ *       - Failure : -1
+ */
+static int
+slabGrow(slabCache_t *cache)
+{
+	slab_t	*s;
+	char	*obj;
+	int	j;
+
+	s = memAllocAligned(SLAB_SIZE, SLAB_SIZE);
+	if (s == NULL) {
+		return (-1);
+	}
+	s->cache = cache;
+	s->magic = MAGIC_SLAB;
+	s->inUse = 0;
+	s->freeObj = NULL;
+	/* Thread free objects so that lowest address is used first. */
+	obj = (char *) s + SLAB_SIZE - (SLAB_SIZE - sizeof(slab_t)) %
+	      cache->objSize;
+	for (j = 0; j < cache->objsPerSlab; j++) {
+		obj -= cache->objSize;
+		* (void **) obj = s->freeObj;
+		s->freeObj = obj;
+	}
+	slabListInsert(&cache->partial, s);
+	return 0;
+}
+
+#ifdef UNIT_TEST
+/**
+ * @brief
+ * Do sanity test of the data-strs of a slab cache.
+ *
+ * @param[in]
+ *       cache: Cache to be checked.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None: on success
+ *       - Assert fail: on failure
+ */
+static void
+sanityCheck(slabCache_t *cache)
+{
+	slab_t	*s;
+	void	*obj;
+	int	nfree;
+
+	for (s = cache->partial; s; s = s->next) {
+		if ((s->magic != MAGIC_SLAB) || (s->cache != cache)) {
+			assert(0);
+		}
+		/* A partial slab must have a free object. */
+		if (s->freeObj == NULL) {
+			assert(0);
+		}
+		nfree = 0;
+		for (obj = s->freeObj; obj; obj = * (void **) obj) {
+			/* Free object must be within the slab. */
+			if (slabOf(obj) != s) {
+				assert(0);
+			}
+			nfree++;
+		}
+		if (nfree + s->inUse != cache->objsPerSlab) {
+			assert(0);
+		}
+		if (s->next && (s->next->prev != s)) {
+			assert(0);
+		}
+	}
+	for (s = cache->full; s; s = s->next) {
+		if ((s->magic != MAGIC_SLAB) || (s->cache != cache)) {
+			assert(0);
+		}
+		if (s->freeObj || (s->inUse != cache->objsPerSlab)) {
+			assert(0);
+		}
+		if (s->next && (s->next->prev != s)) {
+			assert(0);
+		}
+	}
+	return;
+}
+#endif /* UNIT_TEST */
+
+/**
+ * @brief
+ * API to create a cache of objects of a given size.
+ *
+ * @param[in]
+ *       objSize: Size of each object in the cache.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to new cache
+ *       - Failure : NULL
+ */
+slabCache_t *
+slabCacheCreate(int objSize)
+{
+	slabCache_t *cache;
+
+	/* Free objects must be able to hold the free list link. */
+	if (objSize < sizeof(void *)) {
+		objSize = sizeof(void *);
+	}
+	/* Align size to size of pointer */
+	objSize = (objSize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	/* A slab must hold a reasonable number of objects. */
+	if (objSize > (SLAB_SIZE - sizeof(slab_t)) / 8) {
+		return NULL;
+	}
+
+	cache = memAlloc(sizeof(slabCache_t));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->objSize = objSize;
+	cache->objsPerSlab = (SLAB_SIZE - sizeof(slab_t)) / objSize;
+	cache->partial = NULL;
+	cache->full = NULL;
+	return cache;
+}
+
+/**
+ * @brief
+ * API to destroy a cache. All memory of the cache, including objects
+ * not freed yet, is returned to memory management.
+ *
+ * @param[in]
+ *       cache: Cache to be destroyed.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+slabCacheDestroy(slabCache_t *cache)
+{
+	slab_t	*s;
+
+	if (!cache) return;
+
+	while ((s = cache->partial) != NULL) {
+		slabListRemove(&cache->partial, s);
+		s->magic = 0;
+		memFree(s);
+	}
+	while ((s = cache->full) != NULL) {
+		slabListRemove(&cache->full, s);
+		s->magic = 0;
+		memFree(s);
+	}
+	memFree(cache);
+	return;
+}
+
+/**
+ * @brief
+ * API to allocate an object from a cache.
+ *
+ * @note
+ * Objects are allocated from the slab at the head of the partial list,
+ * so this is O(1) except when the cache needs to grow by a slab.
+ *
+ * @param[in]
+ *       cache: Cache to allocate from.
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - Success : Pointer to object
+ *       - Failure : NULL
+ */
+void *
+slabAlloc(slabCache_t *cache)
+{
+	slab_t	*s;
+	void	*obj;
+
+	if (cache->partial == NULL) {
+		if (slabGrow(cache) < 0) {
+			return NULL;
+		}
+	}
+	s = cache->partial;
+	obj = s->freeObj;
+	s->freeObj = * (void **) obj;
+	s->inUse++;
+	if (s->freeObj == NULL) {
+		slabListRemove(&cache->partial, s);
+		slabListInsert(&cache->full, s);
+	}
+#ifdef UNIT_TEST
+	sanityCheck(cache);
+#endif /* UNIT_TEST */
+	return obj;
+}
+
+/**
+ * @brief
+ * API to free an object back to its cache.
+ *
+ * @param[in]
+ *       cache: Cache the object was allocated from.
+ *       obj: Object to be freed. Must be same as what was
+ *            returned by slabAlloc().
+ *
+ * @param[out]
+ *       None.
+ *
+ * @return
+ *       - None.
+ */
+void
+slabFree(slabCache_t *cache, void *obj)
+{
+	slab_t	*s;
+
+	if (!obj) return;
+
+	s = slabOf(obj);
+	if ((s->magic != MAGIC_SLAB) || (s->cache != cache)) {
+		/* Sanity failed! */
+		return;
+	}
+
+	if (s->freeObj == NULL) {
+		slabListRemove(&cache->full, s);
+		slabListInsert(&cache->partial, s);
+	}
+	* (void **) obj = s->freeObj;
+	s->freeObj = obj;
+	s->inUse--;
+
+	/* Give an empty slab back, unless it is the only one left to
+	 * allocate from.
+	 */
+	if ((s->inUse == 0) && (s->next || s->prev)) {
+		slabListRemove(&cache->partial, s);
+		s->magic = 0;
+		memFree(s);
+	}
+#ifdef UNIT_TEST
+	sanityCheck(cache);
+#endif /* UNIT_TEST */
+	return;
+}
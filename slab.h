@@ -0,0 +1,23 @@
+/**
+ * @file      slab.h
+ * @brief     Include file for toy kernel slab allocator
+ *
+ * Caches of fixed-size objects layered over the toy kernel memory
+ * management.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+/* Cache of objects of one size */
+typedef struct slabCache_ slabCache_t;
+
+slabCache_t *slabCacheCreate(int objSize);
+void slabCacheDestroy(slabCache_t *cache);
+void *slabAlloc(slabCache_t *cache);
+void slabFree(slabCache_t *cache, void *obj);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,68 @@
+/**
+ * @file      slabtest.c
+ * @brief     Unit test for toy kernel slab allocator.
+ *
+ * Test out toy kernel slab allocator.
+ *
+ * @author    Natarajan Venkataraman, mr.v.natarajan@gmail.com
+ * @copyright Copyright (c) 2016, Natarajan Venkataraman
+ */
+
+#include <mem.h>
+#include <slab.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+char space[1*1024*1024];
+
+int
+main(void)
+{
+	srandom(getpid());
+	{
+		slabCache_t *c;
+		void *ptr[100] = {0};
+		int i;
+
+		memInit(space, sizeof(space));
+		c = slabCacheCreate(24);
+		for(i=0; i<100; i++) {
+			ptr[i] = slabAlloc(c);
+		}
+		for(i=0; i<100; i+=2) {
+			slabFree(c, ptr[i]);
+		}
+		for(i=0; i<100; i+=2) {
+			ptr[i] = slabAlloc(c);
+		}
+		for(i=100; i>0; i--) {
+			slabFree(c, ptr[i-1]);
+		}
+		slabCacheDestroy(c);
+		assert(slabCacheCreate(4096) == NULL); // Create must fail.
+	}
+	{
+		slabCache_t *c[3];
+		int i, j, idx;
+		void *ptr[3][1000] = {{0}};
+
+		memInit(space, sizeof(space));
+		c[0] = slabCacheCreate(1);
+		c[1] = slabCacheCreate(56);
+		c[2] = slabCacheCreate(300);
+		for(i=0; i<100000; i++) {
+			j = random() % 3;
+			idx = random() % 1000;
+			if (ptr[j][idx] == 0) {
+				ptr[j][idx] = slabAlloc(c[j]);
+			} else {
+				slabFree(c[j], ptr[j][idx]);
+				ptr[j][idx] = 0;
+			}
+		}
+		for(j=0; j<3; j++) {
+			slabCacheDestroy(c[j]);
+		}
+	}
+}